@@ -15,6 +15,18 @@ g++ -O3 -std=c++17 \
 # Build searchx
 g++ -O3 -std=c++17 \
     "$ROOT_DIR/src/searchx.cpp" \
+    -lpthread \
     -o "$ROOT_DIR/bin/searchx"
 
 echo "Built bin/vaultx and bin/searchx"
+
+# ./scripts/build_hashgen.sh bench: also build the kernel microbenchmarks
+# (bin/vaultx_bench --help; CSV or JSON rows per kernel)
+if [ "${1:-}" = "bench" ]; then
+    g++ -O3 -std=c++17 \
+        -Isrc/BLAKE3/c \
+        "$ROOT_DIR/src/vaultx_bench.cpp" "$ROOT_DIR/src/BLAKE3/c/blake3.c" \
+        -lpthread \
+        -o "$ROOT_DIR/bin/vaultx_bench"
+    echo "Built bin/vaultx_bench"
+fi
@@ -0,0 +1,293 @@
+// blake3_lanes.h - batched BLAKE3 for vaultx record generation.
+//
+// Every vaultx input is a NONCE_SIZE-byte little-endian counter, which fits in
+// one 64-byte block of one chunk. Its BLAKE3 hash is therefore a single
+// compression of the IV with flags CHUNK_START|CHUNK_END|ROOT, counter 0 and
+// block_len NONCE_SIZE; the hasher init/update/finalize round trip is pure
+// overhead. The kernels below run that one compression for 1 (scalar),
+// 8 (AVX2) or 16 (AVX-512) nonces at a time, one nonce per lane, and store
+// the truncated hash and nonce straight into the Record array. Each kernel
+// is written once over a nonce source: consecutive nonces for generation
+// (GenFn) or an arbitrary list for verification (HashFn).
+//
+// The compressions (compress1/8/16) do not depend on the record layout and
+// are compiled once; only the thin loops that feed them nonces and store
+// Record<H, N> are instantiated per layout.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define B3L_X86 1
+#endif
+
+#include "vault_layout.h"
+
+namespace b3l {
+
+static const uint32_t IV[8] = {
+    0x6A09E667u, 0xBB67AE85u, 0x3C6EF372u, 0xA54FF53Au,
+    0x510E527Fu, 0x9B05688Cu, 0x1F83D9ABu, 0x5BE0CD19u};
+static const uint8_t SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}};
+static const uint32_t FLAGS = 1u | 2u | 8u; // CHUNK_START | CHUNK_END | ROOT
+
+// Nonce sources: src(i) is the i-th nonce, src.shift(k) drops the first k.
+struct Seq {
+    uint64_t first;
+    uint64_t operator()(size_t i) const { return first + i; }
+    Seq shift(size_t k) const { return Seq{first + k}; }
+};
+struct List {
+    const uint64_t* v;
+    uint64_t operator()(size_t i) const { return v[i]; }
+    List shift(size_t k) const { return List{v + k}; }
+};
+
+// ---- scalar -------------------------------------------------------------
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline void g1(uint32_t* s, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    s[a] = s[a] + s[b] + x; s[d] = rotr32(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];     s[b] = rotr32(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + y; s[d] = rotr32(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];     s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+// The first `words` output words for input v (len bytes, little-endian).
+static inline void compress1(uint64_t v, uint32_t len, int words, uint32_t* o) {
+    uint32_t m[16] = {(uint32_t)v, (uint32_t)(v >> 32)};
+    uint32_t s[16] = {IV[0], IV[1], IV[2], IV[3], IV[4], IV[5], IV[6], IV[7],
+                      IV[0], IV[1], IV[2], IV[3], 0, 0, len, FLAGS};
+    for (int r=0; r<7; ++r) {
+        const uint8_t* p = SCHEDULE[r];
+        g1(s, 0, 4,  8, 12, m[p[0]],  m[p[1]]);
+        g1(s, 1, 5,  9, 13, m[p[2]],  m[p[3]]);
+        g1(s, 2, 6, 10, 14, m[p[4]],  m[p[5]]);
+        g1(s, 3, 7, 11, 15, m[p[6]],  m[p[7]]);
+        g1(s, 0, 5, 10, 15, m[p[8]],  m[p[9]]);
+        g1(s, 1, 6, 11, 12, m[p[10]], m[p[11]]);
+        g1(s, 2, 7,  8, 13, m[p[12]], m[p[13]]);
+        g1(s, 3, 4,  9, 14, m[p[14]], m[p[15]]);
+    }
+    for (int w=0; w<words; ++w) o[w] = s[w] ^ s[w + 8];
+}
+
+#ifdef B3L_X86
+// ---- AVX2: 8 lanes --------------------------------------------------------
+
+#define B3L_AVX2 __attribute__((target("avx2")))
+
+B3L_AVX2 static inline __m256i rot16_8(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(
+        13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2, 13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2));
+}
+B3L_AVX2 static inline __m256i rot8_8(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(
+        12,15,14,13, 8,11,10,9, 4,7,6,5, 0,3,2,1, 12,15,14,13, 8,11,10,9, 4,7,6,5, 0,3,2,1));
+}
+B3L_AVX2 static inline __m256i rot12_8(__m256i x) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+}
+B3L_AVX2 static inline __m256i rot7_8(__m256i x) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+}
+B3L_AVX2 static inline void g8(__m256i* s, int a, int b, int c, int d, __m256i x, __m256i y) {
+    s[a] = _mm256_add_epi32(_mm256_add_epi32(s[a], s[b]), x); s[d] = rot16_8(_mm256_xor_si256(s[d], s[a]));
+    s[c] = _mm256_add_epi32(s[c], s[d]);                      s[b] = rot12_8(_mm256_xor_si256(s[b], s[c]));
+    s[a] = _mm256_add_epi32(_mm256_add_epi32(s[a], s[b]), y); s[d] = rot8_8(_mm256_xor_si256(s[d], s[a]));
+    s[c] = _mm256_add_epi32(s[c], s[d]);                      s[b] = rot7_8(_mm256_xor_si256(s[b], s[c]));
+}
+
+// Eight compressions, input words lo/hi per lane; o[w][lane] is output word w.
+B3L_AVX2 static void compress8(const uint32_t* lo, const uint32_t* hi, uint32_t len, int words, uint32_t (*o)[8]) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i m[16];
+    m[0] = _mm256_load_si256((const __m256i*)lo);
+    m[1] = _mm256_load_si256((const __m256i*)hi);
+    for (int w=2; w<16; ++w) m[w] = zero;
+    __m256i s[16];
+    for (int w=0; w<8; ++w) s[w] = _mm256_set1_epi32((int)IV[w]);
+    for (int w=0; w<4; ++w) s[8 + w] = _mm256_set1_epi32((int)IV[w]);
+    s[12] = zero; s[13] = zero;
+    s[14] = _mm256_set1_epi32((int)len);
+    s[15] = _mm256_set1_epi32((int)FLAGS);
+    for (int r=0; r<7; ++r) {
+        const uint8_t* p = SCHEDULE[r];
+        g8(s, 0, 4,  8, 12, m[p[0]],  m[p[1]]);
+        g8(s, 1, 5,  9, 13, m[p[2]],  m[p[3]]);
+        g8(s, 2, 6, 10, 14, m[p[4]],  m[p[5]]);
+        g8(s, 3, 7, 11, 15, m[p[6]],  m[p[7]]);
+        g8(s, 0, 5, 10, 15, m[p[8]],  m[p[9]]);
+        g8(s, 1, 6, 11, 12, m[p[10]], m[p[11]]);
+        g8(s, 2, 7,  8, 13, m[p[12]], m[p[13]]);
+        g8(s, 3, 4,  9, 14, m[p[14]], m[p[15]]);
+    }
+    for (int w=0; w<words; ++w)
+        _mm256_store_si256((__m256i*)o[w], _mm256_xor_si256(s[w], s[w + 8]));
+}
+
+// ---- AVX-512: 16 lanes ----------------------------------------------------
+
+#define B3L_AVX512 __attribute__((target("avx512f")))
+
+// _mm512_ror_epi32 passes an undefined vector as its (unused) merge source,
+// which GCC reports as uninitialized; the zero-masking form with every lane
+// selected is the same vprord without it.
+#define B3L_ROR16(x, n) _mm512_maskz_ror_epi32((__mmask16)0xFFFF, (x), (n))
+
+B3L_AVX512 static inline void g16(__m512i* s, int a, int b, int c, int d, __m512i x, __m512i y) {
+    s[a] = _mm512_add_epi32(_mm512_add_epi32(s[a], s[b]), x); s[d] = B3L_ROR16(_mm512_xor_si512(s[d], s[a]), 16);
+    s[c] = _mm512_add_epi32(s[c], s[d]);                      s[b] = B3L_ROR16(_mm512_xor_si512(s[b], s[c]), 12);
+    s[a] = _mm512_add_epi32(_mm512_add_epi32(s[a], s[b]), y); s[d] = B3L_ROR16(_mm512_xor_si512(s[d], s[a]), 8);
+    s[c] = _mm512_add_epi32(s[c], s[d]);                      s[b] = B3L_ROR16(_mm512_xor_si512(s[b], s[c]), 7);
+}
+
+B3L_AVX512 static void compress16(const uint32_t* lo, const uint32_t* hi, uint32_t len, int words, uint32_t (*o)[16]) {
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i m[16];
+    m[0] = _mm512_load_si512(lo);
+    m[1] = _mm512_load_si512(hi);
+    for (int w=2; w<16; ++w) m[w] = zero;
+    __m512i s[16];
+    for (int w=0; w<8; ++w) s[w] = _mm512_set1_epi32((int)IV[w]);
+    for (int w=0; w<4; ++w) s[8 + w] = _mm512_set1_epi32((int)IV[w]);
+    s[12] = zero; s[13] = zero;
+    s[14] = _mm512_set1_epi32((int)len);
+    s[15] = _mm512_set1_epi32((int)FLAGS);
+    for (int r=0; r<7; ++r) {
+        const uint8_t* p = SCHEDULE[r];
+        g16(s, 0, 4,  8, 12, m[p[0]],  m[p[1]]);
+        g16(s, 1, 5,  9, 13, m[p[2]],  m[p[3]]);
+        g16(s, 2, 6, 10, 14, m[p[4]],  m[p[5]]);
+        g16(s, 3, 7, 11, 15, m[p[6]],  m[p[7]]);
+        g16(s, 0, 5, 10, 15, m[p[8]],  m[p[9]]);
+        g16(s, 1, 6, 11, 12, m[p[10]], m[p[11]]);
+        g16(s, 2, 7,  8, 13, m[p[12]], m[p[13]]);
+        g16(s, 3, 4,  9, 14, m[p[14]], m[p[15]]);
+    }
+    for (int w=0; w<words; ++w)
+        _mm512_store_si512(o[w], _mm512_xor_si512(s[w], s[w + 8]));
+}
+#endif // B3L_X86
+
+// ---- per-layout loops -------------------------------------------------------
+
+template <int H, int N>
+struct Lanes {
+    static_assert(N <= 8, "nonce is generated from a 64-bit counter");
+    static_assert(H <= 32, "hash is truncated from BLAKE3_OUT_LEN");
+    using Record = vlay::Record<H, N>;
+    static constexpr uint64_t NONCE_MASK = N == 8 ? ~0ULL : ((1ULL << (8 * N)) - 1);
+    static constexpr int OUT_WORDS = (H + 3) / 4;
+
+    // words[w * stride] is output word w of this record's compression.
+    static inline void put_record(uint64_t v, const uint32_t* words, size_t stride, Record& r) {
+        uint8_t h[OUT_WORDS * 4];
+        for (int w=0; w<OUT_WORDS; ++w)
+            for (int b=0; b<4; ++b) h[4*w + b] = (uint8_t)(words[w * stride] >> (8*b));
+        std::memcpy(r.hash, h, H);
+        for (int b=0; b<N; ++b) { r.nonce[b] = (uint8_t)(v & 0xFF); v >>= 8; }
+    }
+
+    template <typename Src>
+    static void run_scalar(Src src, size_t n, Record* out) {
+        for (size_t i=0; i<n; ++i) {
+            uint32_t o[OUT_WORDS];
+            compress1(src(i) & NONCE_MASK, N, OUT_WORDS, o);
+            put_record(src(i), o, 1, out[i]);
+        }
+    }
+
+#ifdef B3L_X86
+    // Lanes of nonces from src(i..i+L) for compressL, then the L records.
+    template <int L, typename Src, typename Compress>
+    static void run_lanes(Src src, size_t n, Record* out, Compress compress, size_t& i) {
+        for (; i + L <= n; i += L) {
+            alignas(64) uint32_t lo[L], hi[L], o[OUT_WORDS][L];
+            for (int l=0; l<L; ++l) {
+                uint64_t v = src(i + l) & NONCE_MASK;
+                lo[l] = (uint32_t)v; hi[l] = (uint32_t)(v >> 32);
+            }
+            compress(lo, hi, N, OUT_WORDS, o);
+            for (int l=0; l<L; ++l) put_record(src(i + l), &o[0][l], L, out[i + l]);
+        }
+    }
+
+    template <typename Src>
+    static void run_avx2(Src src, size_t n, Record* out) {
+        size_t i = 0;
+        run_lanes<8>(src, n, out, compress8, i);
+        run_scalar(src.shift(i), n - i, out + i);
+    }
+
+    template <typename Src>
+    static void run_avx512(Src src, size_t n, Record* out) {
+        size_t i = 0;
+        run_lanes<16>(src, n, out, compress16, i);
+        run_avx2(src.shift(i), n - i, out + i);
+    }
+#endif
+
+    // GenFn: records for nonces first..first+n-1. HashFn: records for nonces[0..n).
+    typedef void (*GenFn)(uint64_t first, size_t n, Record* out);
+    typedef void (*HashFn)(const uint64_t* nonces, size_t n, Record* out);
+
+    static void gen_scalar(uint64_t first, size_t n, Record* out) { run_scalar(Seq{first}, n, out); }
+    static void hash_scalar(const uint64_t* nonces, size_t n, Record* out) { run_scalar(List{nonces}, n, out); }
+#ifdef B3L_X86
+    static void gen_avx2(uint64_t first, size_t n, Record* out) { run_avx2(Seq{first}, n, out); }
+    static void hash_avx2(const uint64_t* nonces, size_t n, Record* out) { run_avx2(List{nonces}, n, out); }
+    static void gen_avx512(uint64_t first, size_t n, Record* out) { run_avx512(Seq{first}, n, out); }
+    static void hash_avx512(const uint64_t* nonces, size_t n, Record* out) { run_avx512(List{nonces}, n, out); }
+#endif
+};
+
+// ---- dispatch ---------------------------------------------------------------
+
+// Best instruction set the running CPU supports: "avx512", "avx2" or
+// "scalar". `force` ("scalar", "avx2") pins a lower one for benchmarking
+// and is ignored if the CPU lacks it.
+static inline const char* select_isa(const char* force) {
+#ifdef B3L_X86
+    __builtin_cpu_init();
+    const bool has2 = __builtin_cpu_supports("avx2");
+    const bool has512 = __builtin_cpu_supports("avx512f");
+    if (force && std::strcmp(force, "scalar") == 0) return "scalar";
+    if (force && std::strcmp(force, "avx2") == 0) return has2 ? "avx2" : "scalar";
+    if (has512) return "avx512";
+    if (has2) return "avx2";
+#else
+    (void)force;
+#endif
+    return "scalar";
+}
+
+template <int H, int N>
+struct Kernel {
+    const char* name;
+    typename Lanes<H, N>::GenFn fn;
+    typename Lanes<H, N>::HashFn hash;
+};
+
+template <int H, int N>
+static Kernel<H, N> select_kernel(const char* force = nullptr) {
+    using K = Lanes<H, N>;
+    const char* isa = select_isa(force);
+#ifdef B3L_X86
+    if (std::strcmp(isa, "avx512") == 0) return {isa, K::gen_avx512, K::hash_avx512};
+    if (std::strcmp(isa, "avx2") == 0) return {isa, K::gen_avx2, K::hash_avx2};
+#endif
+    return {isa, K::gen_scalar, K::hash_scalar};
+}
+
+} // namespace b3l
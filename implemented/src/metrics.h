@@ -0,0 +1,215 @@
+// metrics.h - phase timers, counters and hardware counters for --metrics.
+//
+// A Registry collects what a run did and writes it as one JSON document:
+//
+//   phases    wall span of each phase plus the I/O (vio::io_stats) and the
+//             perf_event_open counters (cycles, instructions, LLC misses,
+//             CPU time) that fall inside it, where the kernel allows them
+//   threads   per-thread timers reported once by each worker at its end
+//             (busy, stall, read, write seconds and so on)
+//   counters  named totals (records, runs, passes, ...)
+//   hists     named histograms (searchx: seeks and latency per query)
+//
+// Every update happens per phase, per thread or per chunk, never per record,
+// so the registry is always on and --metrics only decides whether the
+// document gets written.
+//
+// Include after vault_io.h.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace vmet {
+
+static inline double now_s() {
+    static const auto t0 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Process-wide cycles, instructions, LLC misses and CPU time (user space
+// only, so it works at the default perf_event_paranoid level). The counters
+// are opened with inherit=1 before any worker starts, so threads created
+// later are included; a thread's counts fold into the totals when it exits,
+// which is how our phases end anyway. Each counter is optional: VMs often
+// expose no hardware PMU, and then only task_clock_ns is reported.
+struct Perf {
+    static const int N = 4;
+    int fd[N] = {-1, -1, -1, -1};
+    static const char* name(int i) {
+        static const char* names[N] = {"cycles", "instructions", "llc_misses", "task_clock_ns"};
+        return names[i];
+    }
+    void open() {
+        const uint32_t type[N] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+        const uint64_t cfg[N] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+                                 PERF_COUNT_SW_TASK_CLOCK};
+        for (int i=0; i<N; ++i) {
+            perf_event_attr a;
+            std::memset(&a, 0, sizeof(a));
+            a.size = sizeof(a);
+            a.type = type[i];
+            a.config = cfg[i];
+            a.inherit = 1;
+            a.exclude_kernel = 1;
+            a.exclude_hv = 1;
+            fd[i] = (int)::syscall(__NR_perf_event_open, &a, 0, -1, -1, 0);
+        }
+    }
+    bool available() const { return fd[0] >= 0; }   // hardware counters
+    void read(uint64_t out[N]) const {
+        for (int i=0; i<N; ++i) {
+            out[i] = 0;
+            if (fd[i] >= 0 && ::read(fd[i], &out[i], sizeof(uint64_t)) != (ssize_t)sizeof(uint64_t)) out[i] = 0;
+        }
+    }
+    void close() { for (int& f: fd) { if (f >= 0) ::close(f); f = -1; } }
+    ~Perf() { close(); }
+};
+
+// Power-of-two histogram: bucket b counts values in [2^(b-1), 2^b), bucket 0
+// counts zeros. Merge per-thread copies with add().
+struct Hist {
+    uint64_t b[64] = {0};
+    void put(uint64_t v) { ++b[v ? 64 - __builtin_clzll(v) : 0]; }
+    void add(const Hist& o) { for (int i=0; i<64; ++i) b[i] += o.b[i]; }
+};
+
+class Registry {
+public:
+    typedef std::vector<std::pair<std::string, double>> Fields;
+
+    // Call before starting threads so perf counters inherit into them.
+    void start(const char* tool, bool perf) {
+        tool_ = tool;
+        t0_ = now_s();
+        if (perf) perf_.open();
+    }
+    void config(const std::string& key, const std::string& value) { config_.emplace_back(key, value); }
+
+    int begin(const std::string& name) {
+        std::lock_guard<std::mutex> g(mu_);
+        Phase p;
+        p.name = name;
+        p.t0 = now_s();
+        snap(p.io0, p.hw0);
+        phases_.push_back(p);
+        return (int)phases_.size() - 1;
+    }
+    void end(int id, const Fields& extra = Fields()) {
+        std::lock_guard<std::mutex> g(mu_);
+        Phase& p = phases_[id];
+        p.t1 = now_s();
+        snap(p.io1, p.hw1);
+        p.extra = extra;
+    }
+    void thread(const std::string& phase, const std::string& role, int id, const Fields& f) {
+        std::lock_guard<std::mutex> g(mu_);
+        threads_.push_back(Thread{phase, role, id, f});
+    }
+    void count(const std::string& name, uint64_t v) {
+        std::lock_guard<std::mutex> g(mu_);
+        counters_[name] += v;
+    }
+    void hist(const std::string& name, const Hist& h) {
+        std::lock_guard<std::mutex> g(mu_);
+        hists_[name].add(h);
+    }
+
+    bool write(const std::string& path) const {
+        FILE* f = std::fopen(path.c_str(), "w");
+        if (!f) return false;
+        std::lock_guard<std::mutex> g(mu_);
+        std::fprintf(f, "{\n  \"tool\": \"%s\",\n  \"wall_s\": %.6f,\n  \"config\": {", tool_.c_str(), now_s() - t0_);
+        for (size_t i=0; i<config_.size(); ++i)
+            std::fprintf(f, "%s\n    \"%s\": \"%s\"", i ? "," : "", config_[i].first.c_str(), config_[i].second.c_str());
+        std::fprintf(f, "\n  },\n  \"perf_available\": %s,\n  \"phases\": [", perf_.available() ? "true" : "false");
+        for (size_t i=0; i<phases_.size(); ++i) {
+            const Phase& p = phases_[i];
+            std::fprintf(f, "%s\n    {\"name\": \"%s\", \"start_s\": %.6f, \"wall_s\": %.6f", i ? "," : "",
+                p.name.c_str(), p.t0 - t0_, p.t1 > 0 ? p.t1 - p.t0 : 0.0);
+            const char* io_names[IO_N] = {"read_bytes", "write_bytes", "reads", "writes"};
+            for (int k=0; k<IO_N; ++k) std::fprintf(f, ", \"%s\": %llu", io_names[k], (unsigned long long)(p.io1[k] - p.io0[k]));
+            for (int k=0; k<Perf::N; ++k)
+                if (perf_.fd[k] >= 0) std::fprintf(f, ", \"%s\": %llu", Perf::name(k), (unsigned long long)(p.hw1[k] - p.hw0[k]));
+            for (auto& e: p.extra) { std::fprintf(f, ", \"%s\": ", e.first.c_str()); num(f, e.second); }
+            std::fprintf(f, "}");
+        }
+        std::fprintf(f, "\n  ],\n  \"threads\": [");
+        for (size_t i=0; i<threads_.size(); ++i) {
+            const Thread& t = threads_[i];
+            std::fprintf(f, "%s\n    {\"phase\": \"%s\", \"role\": \"%s\", \"id\": %d", i ? "," : "",
+                t.phase.c_str(), t.role.c_str(), t.id);
+            for (auto& e: t.f) { std::fprintf(f, ", \"%s\": ", e.first.c_str()); num(f, e.second); }
+            std::fprintf(f, "}");
+        }
+        std::fprintf(f, "\n  ],\n  \"counters\": {");
+        size_t i = 0;
+        for (auto& c: counters_) std::fprintf(f, "%s\n    \"%s\": %llu", i++ ? "," : "", c.first.c_str(), (unsigned long long)c.second);
+        std::fprintf(f, "%s\"peak_inflight_bytes\": %llu\n  },\n  \"hists\": {", i ? ",\n    " : "\n    ",
+            (unsigned long long)vio::io_stats.inflight_peak.load());
+        i = 0;
+        for (auto& h: hists_) {
+            int top = 63;
+            while (top > 0 && !h.second.b[top]) --top;
+            std::fprintf(f, "%s\n    \"%s\": [", i++ ? "," : "", h.first.c_str());
+            for (int b=0; b<=top; ++b) std::fprintf(f, "%s%llu", b ? ", " : "", (unsigned long long)h.second.b[b]);
+            std::fprintf(f, "]");
+        }
+        std::fprintf(f, "\n  }\n}\n");
+        return std::fclose(f) == 0;
+    }
+
+private:
+    static const int IO_N = 4;
+    // Whole numbers (counts) exactly, timings and rates to 6 digits.
+    static void num(FILE* f, double v) {
+        if (v == (double)(int64_t)v && v < 9e15 && v > -9e15) std::fprintf(f, "%lld", (long long)v);
+        else std::fprintf(f, "%.6g", v);
+    }
+    struct Phase {
+        std::string name;
+        double t0 = 0, t1 = 0;
+        uint64_t io0[IO_N] = {0}, io1[IO_N] = {0};
+        uint64_t hw0[Perf::N] = {0}, hw1[Perf::N] = {0};
+        Fields extra;
+    };
+    struct Thread { std::string phase, role; int id; Fields f; };
+    void snap(uint64_t io[IO_N], uint64_t hw[Perf::N]) const {
+        io[0] = vio::io_stats.read_bytes.load(std::memory_order_relaxed);
+        io[1] = vio::io_stats.write_bytes.load(std::memory_order_relaxed);
+        io[2] = vio::io_stats.reads.load(std::memory_order_relaxed);
+        io[3] = vio::io_stats.writes.load(std::memory_order_relaxed);
+        perf_.read(hw);
+    }
+    mutable std::mutex mu_;
+    std::string tool_;
+    double t0_ = 0;
+    Perf perf_;
+    std::vector<std::pair<std::string, std::string>> config_;
+    std::vector<Phase> phases_;
+    std::vector<Thread> threads_;
+    std::map<std::string, uint64_t> counters_;
+    std::map<std::string, Hist> hists_;
+};
+
+// Ends its phase when it goes out of scope (early returns included).
+struct PhaseScope {
+    Registry& r;
+    int id;
+    Registry::Fields extra;
+    PhaseScope(Registry& r_, const std::string& name) : r(r_), id(r_.begin(name)) {}
+    ~PhaseScope() { r.end(id, extra); }
+};
+
+} // namespace vmet
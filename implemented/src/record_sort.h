@@ -0,0 +1,104 @@
+// record_sort.h - parallel MSD radix sort for Record arrays.
+//
+// Hashes are uniform, so one 8-bit digit per level splits a run into 256
+// near-equal buckets and two or three levels leave cache-sized pieces that
+// std::sort finishes quickly. The top level histogram and scatter are split
+// across T threads; the resulting buckets go on a shared work queue (largest
+// first) and each thread sorts its buckets serially, ping-ponging between
+// the run and an equally sized scratch buffer.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "vault_layout.h"
+
+namespace rsort {
+
+static const size_t SMALL = 2048;   // ~32 KB of records: fits in L1/L2
+
+// Sort n records found in `data`; `other` is scratch of the same size.
+// On return the sorted records are in `data` if into_data, else in `other`.
+template <int H, int N>
+static void msd(vlay::Record<H, N>* data, vlay::Record<H, N>* other, size_t n, int d, bool into_data) {
+    if (n <= SMALL || d >= H) {
+        vlay::Record<H, N>* dst = data;
+        if (!into_data) { std::memcpy(other, data, n * sizeof(*data)); dst = other; }
+        if (d < H) std::sort(dst, dst + n, vlay::rec_less<H, N>);
+        return;
+    }
+    size_t cnt[256] = {0};
+    for (size_t i=0; i<n; ++i) ++cnt[data[i].hash[d]];
+    size_t off[256], pos = 0;
+    for (int b=0; b<256; ++b) { off[b] = pos; pos += cnt[b]; }
+    for (size_t i=0; i<n; ++i) other[off[data[i].hash[d]]++] = data[i];
+    pos = 0;
+    for (int b=0; b<256; ++b) {
+        if (cnt[b]) msd(other + pos, data + pos, cnt[b], d + 1, !into_data);
+        pos += cnt[b];
+    }
+}
+
+// Sort a[0..n) by hash using T threads; tmp must hold n records. Callers
+// that know the first d0 hash bytes are shared (e.g. one bucket) skip them.
+// on_thread(th, T), if given, runs first in each worker (thread pinning);
+// worker th histograms and scatters the th-th of T contiguous slices of a.
+template <int H, int N>
+static void radix_sort(vlay::Record<H, N>* a, vlay::Record<H, N>* tmp, size_t n, int T, int d0 = 0,
+                       void (*on_thread)(int, int) = nullptr) {
+    if (T <= 1 || n <= SMALL * 256 || d0 >= H) { msd(a, tmp, n, d0, true); return; }
+
+    std::vector<size_t> hist((size_t)T * 256, 0);
+    const size_t chunk = (n + T - 1) / T;
+    auto parallel = [T, on_thread](auto&& fn) {
+        std::vector<std::thread> pool; pool.reserve(T);
+        for (int th=0; th<T; ++th) pool.emplace_back([&fn, th, T, on_thread] {
+            if (on_thread) on_thread(th, T);
+            fn(th);
+        });
+        for (auto& t: pool) t.join();
+    };
+
+    parallel([&](int th) {
+        size_t* h = &hist[(size_t)th * 256];
+        for (size_t i = std::min(n, th * chunk), e = std::min(n, (th + 1) * chunk); i < e; ++i) ++h[a[i].hash[d0]];
+    });
+
+    // Column-major prefix sum: bucket b of thread th starts after all of
+    // bucket b in threads < th, which keeps the scatter stable.
+    size_t start[257], pos = 0;
+    for (int b=0; b<256; ++b) {
+        start[b] = pos;
+        for (int th=0; th<T; ++th) {
+            size_t c = hist[(size_t)th * 256 + b];
+            hist[(size_t)th * 256 + b] = pos;
+            pos += c;
+        }
+    }
+    start[256] = pos;
+
+    parallel([&](int th) {
+        size_t* h = &hist[(size_t)th * 256];
+        for (size_t i = std::min(n, th * chunk), e = std::min(n, (th + 1) * chunk); i < e; ++i) tmp[h[a[i].hash[d0]]++] = a[i];
+    });
+
+    std::vector<int> order(256);
+    for (int b=0; b<256; ++b) order[b] = b;
+    std::sort(order.begin(), order.end(), [&](int x, int y) {
+        return start[x+1] - start[x] > start[y+1] - start[y];
+    });
+    std::atomic<int> next{0};
+    parallel([&](int) {
+        for (int i = next++; i < 256; i = next++) {
+            int b = order[i];
+            size_t m = start[b+1] - start[b];
+            if (m) msd(tmp + start[b], a + start[b], m, d0 + 1, false);
+        }
+    });
+}
+
+} // namespace rsort
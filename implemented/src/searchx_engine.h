@@ -0,0 +1,734 @@
+// searchx_engine.h - the searchx command line: the query drivers, --serve
+// and --load, and run(). Vault access (opening, sidecars, bound searches,
+// cursors) is vrd::VaultReader in vault_reader.h.
+//
+// What depends on the record layout is a static member of sx::Engine<H, N>,
+// written as if at namespace scope; searchx.cpp's main() runs the
+// instantiation vlay::LAYOUTS<sx::Engine> names for the vault. Options,
+// latency statistics, the wire format and --load are compiled once.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <random>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include "vault_io.h"
+#include "metrics.h"
+#include "vault_filter.h"
+#include "vault_layout.h"
+#include "vault_reader.h"
+
+static vmet::Registry g_metrics;
+
+static volatile sig_atomic_t g_stop = 0;
+static void on_stop(int){ g_stop = 1; }
+
+enum IoMode { IO_POSIX, IO_MMAP, IO_URING };
+static const char* io_name(IoMode m){ return m==IO_MMAP ? "mmap" : m==IO_URING ? "uring" : "posix"; }
+
+struct Opt { int k=26; std::string file; size_t searches=1000; int diff=3; bool debug=false;
+             bool index=true; bool filter=true; bool interp=true; int threads=1; unsigned depth=1; IoMode io=IO_POSIX;
+             std::string serve, load; size_t cache_mb=64; std::string metrics; size_t batch=1; bool nonces=false; };
+
+struct QueryResult { uint64_t matches, comps, seeks; };
+struct ThreadTotals {
+    uint64_t seeks=0, comps=0, bytes=0, matches=0, found=0, queries=0, rejected=0, records=0, read_errors=0;
+    vmet::Hist seeks_h, lat_h;   // per query: device reads, latency in us
+};
+
+static double since_us(std::chrono::steady_clock::time_point t0){
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+}
+
+struct Percentiles { double p50=0, p99=0, p999=0, max=0; };
+static Percentiles percentiles(std::vector<float>& lat){
+    Percentiles r;
+    if(lat.empty()) return r;
+    auto pct = [&](double p){
+        size_t i = std::min(lat.size()-1, (size_t)(p*(lat.size()-1) + 0.5));
+        std::nth_element(lat.begin(), lat.begin()+i, lat.end());
+        return (double)lat[i];
+    };
+    r.p50=pct(0.50); r.p99=pct(0.99); r.p999=pct(0.999);
+    r.max=*std::max_element(lat.begin(), lat.end());
+    return r;
+}
+
+// Per-query latency percentiles, one "latency_us ..." line.
+static Percentiles print_latency(std::vector<float>& lat, const std::string& extra){
+    Percentiles r = percentiles(lat);
+    if(!lat.empty())
+        std::printf("latency_us p50=%.1f p99=%.1f p999=%.1f max=%.1f%s\n", r.p50, r.p99, r.p999, r.max, extra.c_str());
+    return r;
+}
+
+// ---- --serve: vault daemon on a Unix socket ---------------------------------
+//
+// Wire format, native little-endian. A request is a ReqHeader followed by
+// key_len key bytes:
+//   OP_EXACT   key = one full HASH_SIZE hash
+//   OP_PREFIX  key = 1..HASH_SIZE leading hash bytes
+//   OP_RANGE   key = low hash then high hash (2*HASH_SIZE), both inclusive
+// The reply is a RespHeader. The matches are vault records
+// [first, first+count). The first n_records of them, at most
+// min(max_records, MAX_REPLY_RECORDS), follow as full HASH_SIZE+NONCE_SIZE
+// records. Replies come back in request order, so a client can pipeline
+// requests on one connection without waiting for each reply. An exact
+// lookup that the vault's filter sidecar rules out is answered from memory
+// with first = count = 0.
+enum : uint8_t { OP_EXACT=1, OP_PREFIX=2, OP_RANGE=3 };
+enum : uint8_t { ST_OK=0, ST_BAD_REQUEST=1, ST_IO_ERROR=2 };
+struct ReqHeader { uint8_t op, key_len; uint16_t max_records; uint32_t id; };
+struct RespHeader { uint32_t id; uint8_t status, pad; uint16_t n_records; uint64_t first, count; };
+static_assert(sizeof(ReqHeader)==8 && sizeof(RespHeader)==24, "wire headers are packed");
+static const uint16_t MAX_REPLY_RECORDS = 1024;
+
+static bool send_all(int fd, const uint8_t* p, size_t n){
+    while(n){
+        ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+        if(w<0 && errno==EINTR) continue;
+        if(w<=0) return false;
+        p+=w; n-=(size_t)w;
+    }
+    return true;
+}
+
+struct Conn { int fd; std::thread th; std::atomic<bool> done{false}; };
+
+// ---- --load: load generator for a --serve daemon ----------------------------
+//
+// opt.threads connections, each keeping opt.depth requests in flight, send
+// opt.searches prefix lookups of opt.diff bytes in total (exact lookups at
+// full hash length). Latency runs from a request's write to its reply.
+static int run_load(const Opt& opt, vlay::Layout l){
+    sockaddr_un addr; std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(opt.load.size() >= sizeof(addr.sun_path)){ std::fprintf(stderr,"Socket path too long: %s\n", opt.load.c_str()); return 1; }
+    std::memcpy(addr.sun_path, opt.load.c_str(), opt.load.size());
+
+    std::mt19937_64 rng{std::random_device{}()};
+    std::uniform_int_distribution<uint32_t> u8(0,255);
+    std::vector<uint8_t> prefixes(opt.searches*opt.diff);
+    for(auto& x: prefixes) x=(uint8_t)u8(rng);
+    std::vector<float> lat(opt.searches);
+    std::atomic<uint64_t> matches{0}, found{0}, errors{0};
+    const uint8_t op = opt.diff==l.hash ? OP_EXACT : OP_PREFIX;
+    const size_t rec_size = (size_t)(l.hash + l.nonce);
+
+    auto client = [&](size_t begin, size_t end){
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd<0 || ::connect(fd, (sockaddr*)&addr, sizeof(addr))!=0){ perror("connect"); errors += end-begin; if(fd>=0) ::close(fd); return; }
+        std::deque<std::chrono::steady_clock::time_point> sent_at;
+        std::vector<uint8_t> out, in;
+        std::vector<uint8_t> chunk(64*1024);
+        size_t next = begin, done = begin;
+        uint64_t m = 0, f = 0;
+        auto refill = [&]{
+            out.clear();
+            auto now = std::chrono::steady_clock::now();
+            for(; next<end && next-done<opt.depth; ++next){
+                ReqHeader rq{op, (uint8_t)opt.diff, 0, (uint32_t)next};
+                out.insert(out.end(), (uint8_t*)&rq, (uint8_t*)&rq + sizeof(rq));
+                out.insert(out.end(), &prefixes[next*opt.diff], &prefixes[next*opt.diff] + opt.diff);
+                sent_at.push_back(now);
+            }
+            return out.empty() || send_all(fd, out.data(), out.size());
+        };
+        bool ok = refill();
+        while(ok && done<end){
+            ssize_t n = ::read(fd, chunk.data(), chunk.size());
+            if(n<0 && errno==EINTR) continue;
+            if(n<=0) break;
+            in.insert(in.end(), chunk.begin(), chunk.begin()+n);
+            size_t pos = 0;
+            while(in.size()-pos >= sizeof(RespHeader)){
+                RespHeader rs; std::memcpy(&rs, &in[pos], sizeof(rs));
+                size_t len = sizeof(rs) + (size_t)rs.n_records*rec_size;
+                if(in.size()-pos < len) break;
+                lat[done] = (float)since_us(sent_at.front());
+                sent_at.pop_front();
+                if(rs.status!=ST_OK) ++errors;
+                m += rs.count; if(rs.count) ++f;
+                ++done; pos += len;
+            }
+            in.erase(in.begin(), in.begin()+pos);
+            ok = refill();
+        }
+        if(done<end) errors += end-done;
+        matches += m; found += f;
+        ::close(fd);
+    };
+
+    const int phase = g_metrics.begin("load");
+    auto T0=std::chrono::steady_clock::now();
+    {
+        std::vector<std::thread> pool;
+        const size_t per = (opt.searches + opt.threads - 1) / opt.threads;
+        for(int i=0;i<opt.threads;++i){
+            size_t b = std::min(opt.searches, i*per), e = std::min(opt.searches, b+per);
+            pool.emplace_back(client, b, e);
+        }
+        for(auto& th: pool) th.join();
+    }
+    double total_s = std::chrono::duration<double>(std::chrono::steady_clock::now()-T0).count();
+    std::printf("Load Summary: requests=%zu connections=%d queue_depth=%u found_queries=%llu total_matches=%llu errors=%llu\n",
+        opt.searches, opt.threads, opt.depth, (unsigned long long)found.load(),
+        (unsigned long long)matches.load(), (unsigned long long)errors.load());
+    std::printf("total_time=%.6f s requests/sec=%.2f\n", total_s, total_s>0 ? opt.searches/total_s : 0.0);
+    vmet::Hist lat_h;
+    for(float us: lat) lat_h.put((uint64_t)us);
+    Percentiles pc = print_latency(lat, "");
+    g_metrics.end(phase, {{"requests_per_s", total_s>0 ? opt.searches/total_s : 0.0},
+                          {"p50_us", pc.p50}, {"p99_us", pc.p99}, {"p999_us", pc.p999}, {"max_us", pc.max}});
+    g_metrics.hist("latency_us_log2", lat_h);
+    g_metrics.count("requests", opt.searches);
+    g_metrics.count("found_queries", found.load());
+    g_metrics.count("total_matches", matches.load());
+    g_metrics.count("errors", errors.load());
+    return errors ? 1 : 0;
+}
+
+static Opt parse(int argc, char** argv, vlay::Layout lay);
+
+// Writes the --metrics report, if asked for, and passes rc through.
+static int finish_metrics(const Opt& opt, int rc){
+    if(!opt.metrics.empty() && !g_metrics.write(opt.metrics))
+        std::fprintf(stderr,"cannot write metrics to %s\n", opt.metrics.c_str());
+    return rc;
+}
+
+namespace sx {
+
+template <int H, int N>
+struct Engine {
+
+static constexpr int HASH_SIZE = H, NONCE_SIZE = N;
+static constexpr size_t REC_SIZE = H + N;
+typedef vrd::VaultReader<H, N> VaultReader;
+typedef vrd::Cursor<H, N> Cursor;
+typedef vrd::Match<H, N> Match;
+typedef vrd::BoundSearch<H> BoundSearch;
+
+// ---- query drivers ----------------------------------------------------------
+
+// Query q looks up prefixes[q*diff ..]; drivers write its match count and
+// latency, and per-query detail (and nonces, with --nonces) only when
+// debugging.
+struct Batch {
+    const Opt& opt;
+    const VaultReader& r;
+    const vrd::Vault& v;
+    std::vector<uint8_t> prefixes;
+    std::vector<float> lat_us;
+    std::vector<QueryResult> detail;
+    std::vector<std::vector<uint64_t>> nonces;
+    std::atomic<size_t> next{0};
+    Batch(const Opt& o, const VaultReader& r_) : opt(o), r(r_), v(r_.vault()) {}
+    // Threads take queries in chunks so the counter is not contended.
+    bool take(size_t& q, size_t& end){
+        const size_t chunk = std::max<size_t>(256, opt.batch);
+        q = next.fetch_add(chunk);
+        if(q >= opt.searches) return false;
+        end = std::min(opt.searches, q + chunk);
+        return true;
+    }
+};
+
+static void record(Batch& b, ThreadTotals& t, size_t q, uint64_t lo, uint64_t hi, const vrd::QueryStats& st, double us){
+    uint64_t matches = hi>lo ? hi-lo : 0;
+    t.seeks+=st.seeks; t.comps+=st.comps; t.bytes+=st.bytes; t.rejected+=st.filtered;
+    t.matches+=matches; if(matches) ++t.found;
+    ++t.queries; t.seeks_h.put(st.seeks); t.lat_h.put((uint64_t)us);
+    b.lat_us[q] = (float)us;
+    if(b.opt.debug) b.detail[q] = QueryResult{matches, st.comps, st.seeks};
+}
+
+// --nonces: stream query q's matching records; their reads count as the query's.
+static void read_matches(Batch& b, ThreadTotals& t, size_t q, const vrd::Span& s, vrd::QueryStats& st){
+    Cursor c = b.r.records(s);
+    Match m;
+    while(c.next(m)){
+        ++t.records;
+        if(b.opt.debug) b.nonces[q].push_back(m.nonce_value());
+    }
+    if(c.failed()) ++t.read_errors;
+    st.seeks += c.stats().seeks; st.reads_ok += c.stats().reads_ok; st.bytes += c.stats().bytes;
+}
+
+// Blocking reads (--io posix|mmap) through the VaultReader: one query at a
+// time, or --batch queries per lookup_batch call, in which case a query's
+// latency is its whole batch's.
+static void run_sync(Batch& b, ThreadTotals& t){
+    vrd::SyncSource src = b.r.source();
+    const int D = b.opt.diff;
+    std::vector<vrd::Span> spans(b.opt.batch);
+    std::vector<vrd::QueryStats> st(b.opt.batch);
+    size_t q, end;
+    while(b.take(q, end)){
+        for(size_t n; q<end; q+=n){
+            n = std::min(b.opt.batch, end - q);
+            auto t0 = std::chrono::steady_clock::now();
+            std::fill(st.begin(), st.begin() + n, vrd::QueryStats());
+            if(n == 1){
+                uint8_t low[HASH_SIZE], high[HASH_SIZE];
+                vrd::make_prefix_bounds<H>(&b.prefixes[q*D], D, low, high);
+                spans[0] = b.r.bounds(low, high, src, st[0]);
+            } else b.r.lookup_batch(&b.prefixes[q*D], n, D, spans.data(), src, st.data());
+            if(b.opt.nonces) for(size_t i=0;i<n;++i) read_matches(b, t, q+i, spans[i], st[i]);
+            const double us = since_us(t0);
+            for(size_t i=0;i<n;++i) record(b, t, q+i, spans[i].lo, spans[i].hi, st[i], us);
+        }
+    }
+}
+
+// opt.depth queries in flight per thread on one io_uring (--io uring). Each
+// slot runs its lower then upper bound search; whenever a search needs
+// records its slot's read is queued, and all queued reads go to the kernel
+// in one io_uring_enter. The upper bound reuses the slot's last block when
+// it covers the records it wants, as BlockReader does.
+struct Slot {
+    bool busy = false;
+    size_t q = 0;
+    uint8_t low[HASH_SIZE], high[HASH_SIZE];
+    BoundSearch lb, ub;
+    vrd::QueryStats st;
+    std::vector<uint8_t> buf;
+    uint64_t buf_a = 0, buf_n = 0;
+    std::chrono::steady_clock::time_point t0;
+    BoundSearch& cur(){ return lb.done ? ub : lb; }
+    // The upper bound starts once the lower bound is done.
+    void chain(const vrd::Vault& v, bool interp){ if(lb.done && !ub.key) ub.start(v, high, true, interp); }
+};
+
+static void run_uring(Batch& b, ThreadTotals& t, vio::Ring& ring){
+    const vrd::Vault& v = b.v;
+    std::vector<Slot> slots(b.opt.depth);
+    size_t q = 0, end = 0, inflight = 0;
+    bool more = true;
+
+    auto start_next = [&](Slot& s){
+        while(true){
+            if(q >= end) more = more && b.take(q, end);
+            if(!more) return false;
+            s.q = q++; s.st = vrd::QueryStats(); s.buf_n = 0;
+            s.t0 = std::chrono::steady_clock::now();
+            vrd::make_prefix_bounds<H>(&b.prefixes[s.q*b.opt.diff], b.opt.diff, s.low, s.high);
+            if(!vrd::rejected_by_filter<H>(v, s.low, s.high)) break;
+            s.st.filtered = 1; record(b, t, s.q, 0, 0, s.st, since_us(s.t0));
+        }
+        s.ub = BoundSearch();
+        s.lb.start(v, s.low, false, b.r.interp());
+        s.chain(v, b.r.interp());
+        return true;
+    };
+    // Drive a slot until it needs a read (queued) or runs out of queries.
+    auto advance = [&](Slot& s, unsigned idx){
+        while(s.busy){
+            if(s.lb.done && s.ub.done){
+                record(b, t, s.q, s.lb.result, s.ub.result, s.st, since_us(s.t0));
+                s.busy = start_next(s);
+                continue;
+            }
+            BoundSearch& bs = s.cur();
+            if(s.buf_n && bs.need_a >= s.buf_a && bs.need_a + bs.need_n <= s.buf_a + s.buf_n){
+                bs.feed(v, &s.buf[(bs.need_a - s.buf_a)*v.rec_bytes], s.st);
+                s.chain(v, b.r.interp());
+                continue;
+            }
+            s.buf.resize(bs.need_n * v.rec_bytes);
+            s.buf_a = bs.need_a; s.buf_n = 0;
+            s.st.seeks++;
+            vio::io_stats.enter(s.buf.size());
+            ring.queue(false, v.fd, s.buf.data(), s.buf.size(), (off_t)(v.data_off + bs.need_a*v.rec_bytes), idx);
+            ++inflight;
+            return;
+        }
+    };
+
+    for(unsigned i=0; i<slots.size(); ++i){
+        slots[i].busy = start_next(slots[i]);
+        advance(slots[i], i);
+    }
+    ring.flush();
+    while(inflight){
+        ring.reap([&](uint64_t tag, int res){
+            Slot& s = slots[tag];
+            --inflight;
+            BoundSearch& bs = s.cur();
+            const uint8_t* data = nullptr;
+            vio::io_stats.leave(s.buf.size());
+            if(res > 0) vio::io_stats.done(false, (size_t)res);
+            if(res == (int)s.buf.size()){
+                s.st.reads_ok++; s.st.bytes += s.buf.size();
+                s.buf_n = bs.need_n; data = s.buf.data();
+            }
+            bs.feed(v, data, s.st);
+            s.chain(v, b.r.interp());
+            advance(s, (unsigned)tag);
+        });
+        ring.flush();
+    }
+}
+
+// ---- --serve (wire format above) --------------------------------------------
+
+// Append the reply to one request to out.
+static void answer(const VaultReader& r, vrd::PageCache* cache, const ReqHeader& rq, const uint8_t* key,
+                   std::vector<uint8_t>& out, std::atomic<uint64_t>& rejected){
+    RespHeader rs; std::memset(&rs, 0, sizeof(rs));
+    rs.id = rq.id;
+    uint8_t low[HASH_SIZE], high[HASH_SIZE];
+    if(rq.op==OP_EXACT && rq.key_len==HASH_SIZE){ std::memcpy(low,key,HASH_SIZE); std::memcpy(high,key,HASH_SIZE); }
+    else if(rq.op==OP_PREFIX && rq.key_len>=1 && rq.key_len<=HASH_SIZE) vrd::make_prefix_bounds<H>(key,rq.key_len,low,high);
+    else if(rq.op==OP_RANGE && rq.key_len==2*HASH_SIZE){ std::memcpy(low,key,HASH_SIZE); std::memcpy(high,key+HASH_SIZE,HASH_SIZE); }
+    else rs.status = ST_BAD_REQUEST;
+
+    const size_t at = out.size();
+    out.resize(at + sizeof(rs));
+    if(rs.status==ST_OK){
+        Cursor cur = r.range(low, high, cache);
+        if(cur.stats().filtered) rejected++;
+        rs.first = cur.first(); rs.count = cur.count();
+        const uint64_t n = std::min<uint64_t>(rs.count, std::min(rq.max_records, MAX_REPLY_RECORDS));
+        cur.limit(n);
+        out.resize(at + sizeof(rs) + n*REC_SIZE);
+        Match* dst = reinterpret_cast<Match*>(&out[at + sizeof(rs)]);
+        uint64_t got = 0;
+        while(got < n && cur.next(dst[got])) ++got;
+        if(got < n){ rs.status = ST_IO_ERROR; out.resize(at + sizeof(rs)); }
+        else rs.n_records = (uint16_t)n;
+    }
+    std::memcpy(&out[at], &rs, sizeof(rs));
+}
+
+// One thread per connection: parse every complete request in the input,
+// answer them in order, then send all replies with one write.
+static void serve_conn(int fd, const VaultReader& r, vrd::PageCache* cache,
+                       std::atomic<uint64_t>& served, std::atomic<uint64_t>& rejected){
+    std::vector<uint8_t> in, out;
+    std::vector<uint8_t> chunk(64*1024);
+    while(true){
+        ssize_t n = ::read(fd, chunk.data(), chunk.size());
+        if(n<0 && errno==EINTR) continue;
+        if(n<=0) break;
+        in.insert(in.end(), chunk.begin(), chunk.begin()+n);
+        size_t pos = 0;
+        while(in.size()-pos >= sizeof(ReqHeader)){
+            ReqHeader rq; std::memcpy(&rq, &in[pos], sizeof(rq));
+            if(in.size()-pos < sizeof(rq) + rq.key_len) break;
+            answer(r, cache, rq, &in[pos+sizeof(rq)], out, rejected);
+            pos += sizeof(rq) + rq.key_len;
+            served++;
+        }
+        in.erase(in.begin(), in.begin()+pos);
+        if(!out.empty() && !send_all(fd, out.data(), out.size())) break;
+        out.clear();
+    }
+}
+
+static int serve(const Opt& opt, const VaultReader& r){
+    const vrd::Vault& v = r.vault();
+    const uint8_t* map = r.map();
+    sockaddr_un addr; std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(opt.serve.size() >= sizeof(addr.sun_path)){ std::fprintf(stderr,"Socket path too long: %s\n", opt.serve.c_str()); return 1; }
+    std::memcpy(addr.sun_path, opt.serve.c_str(), opt.serve.size());
+    struct stat st{};
+    if(::stat(opt.serve.c_str(), &st)==0){
+        if(!S_ISSOCK(st.st_mode)){ std::fprintf(stderr,"%s exists and is not a socket\n", opt.serve.c_str()); return 1; }
+        ::unlink(opt.serve.c_str());    // stale socket from an earlier run
+    }
+    int ls = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(ls<0 || ::bind(ls, (sockaddr*)&addr, sizeof(addr))!=0 || ::listen(ls, 128)!=0){ perror("serve"); return 1; }
+
+    struct sigaction sa; std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    // The prefix index stays in memory as the top of the search tree; pages
+    // below it come from the mapping or the LRU.
+    std::unique_ptr<vrd::PageCache> cache;
+    if(!map) cache.reset(new vrd::PageCache(v, opt.cache_mb << 20));
+    std::atomic<uint64_t> served{0}, rejected{0};
+    uint64_t accepted = 0;
+    std::list<Conn> conns;
+    std::printf("serving %s on %s: N=%llu index=%d bits filter=%d bits/rec io=%s cache=%zu MiB\n", opt.file.c_str(),
+        opt.serve.c_str(), (unsigned long long)v.N, v.index.bits, v.filter.bits_per_record(), map ? "mmap" : "posix",
+        map ? (size_t)0 : opt.cache_mb);
+    std::fflush(stdout);
+
+    while(!g_stop){
+        pollfd p{ls, POLLIN, 0};
+        if(::poll(&p, 1, 200) > 0){
+            int c = ::accept(ls, nullptr, nullptr);
+            if(c>=0){
+                ++accepted;
+                conns.emplace_back();
+                Conn& cn = conns.back();
+                cn.fd = c;
+                cn.th = std::thread([&, c, pc = cache.get()]{ serve_conn(c, r, pc, served, rejected); cn.done = true; });
+            }
+        }
+        for(auto it=conns.begin(); it!=conns.end(); ){
+            if(it->done){ it->th.join(); ::close(it->fd); it = conns.erase(it); }
+            else ++it;
+        }
+    }
+    ::close(ls);
+    ::unlink(opt.serve.c_str());
+    for(auto& cn: conns) ::shutdown(cn.fd, SHUT_RDWR);
+    for(auto& cn: conns){ cn.th.join(); ::close(cn.fd); }
+    g_metrics.count("requests", served.load());
+    g_metrics.count("connections", accepted);
+    g_metrics.count("filter_rejects", rejected.load());
+    g_metrics.count("cache_hits", cache ? cache->hits() : 0);
+    g_metrics.count("cache_misses", cache ? cache->misses() : 0);
+    std::printf("served requests=%llu connections=%llu cache_hits=%llu cache_misses=%llu filter_rejects=%llu\n",
+        (unsigned long long)served.load(), (unsigned long long)accepted,
+        (unsigned long long)(cache ? cache->hits() : 0), (unsigned long long)(cache ? cache->misses() : 0),
+        (unsigned long long)rejected.load());
+    return 0;
+}
+
+static int run(int argc, char** argv){
+    Opt opt = parse(argc, argv, {HASH_SIZE, NONCE_SIZE});
+    g_metrics.start("searchx", !opt.metrics.empty());
+    const std::pair<const char*, std::string> cfg[] = {
+        {"mode", !opt.load.empty() ? "load" : !opt.serve.empty() ? "serve" : "batch"},
+        {"file", opt.file}, {"searches", std::to_string(opt.searches)}, {"difficulty", std::to_string(opt.diff)},
+        {"method", opt.interp ? "interp" : "binary"}, {"index", opt.index ? "true" : "false"},
+        {"threads", std::to_string(opt.threads)}, {"io", io_name(opt.io)}, {"queue_depth", std::to_string(opt.depth)},
+        {"layout", std::to_string(HASH_SIZE) + ":" + std::to_string(NONCE_SIZE)},
+        {"batch", std::to_string(opt.batch)}, {"nonces", opt.nonces ? "true" : "false"}};
+    for(auto& c: cfg) g_metrics.config(c.first, c.second);
+    if(!opt.load.empty()) return finish_metrics(opt, run_load(opt, {HASH_SIZE, NONCE_SIZE}));
+    return finish_metrics(opt, run_main(opt));
+}
+
+static int run_main(Opt& opt){
+    // A compressed vault opens as the layout in its header, so a --layout
+    // that contradicts it is reported as such, not as a damaged header.
+    const int open_phase = g_metrics.begin("open");
+    std::unique_ptr<vrd::AnyReader> any =
+        vrd::open_any(opt.file, vrd::ReaderOptions{opt.index, opt.filter, opt.interp, opt.io==IO_MMAP}, {HASH_SIZE, NONCE_SIZE});
+    if(!any) return 1;
+    if(!any->as<HASH_SIZE, NONCE_SIZE>()){
+        std::fprintf(stderr,"%s is a %d:%d vault; --layout %d:%d does not match\n", opt.file.c_str(),
+                     any->layout().hash, any->layout().nonce, HASH_SIZE, NONCE_SIZE);
+        return 1;
+    }
+    const VaultReader& reader = *any->as<HASH_SIZE, NONCE_SIZE>();
+    const vrd::Vault& vault = reader.vault();
+    const uint64_t nrec = vault.N;
+    g_metrics.end(open_phase, {{"records", (double)nrec}, {"index_bits", (double)vault.index.bits},
+                               {"filter_bits", (double)vault.filter.bits_per_record()}});
+
+    // mmap serves vaults that fit in RAM; one ring per thread for uring.
+    if(opt.io==IO_MMAP && !reader.map()) opt.io=IO_POSIX;
+    if(opt.io==IO_URING && (opt.batch>1 || opt.nonces)){
+        std::fprintf(stderr,"--batch and --nonces read with posix or mmap; using posix\n");
+        opt.io=IO_POSIX;
+    }
+    std::vector<std::unique_ptr<vio::Ring>> rings;
+    if(opt.io==IO_URING){
+        unsigned n=1; while(n<std::max(8u,opt.depth)) n<<=1;
+        for(int i=0;i<opt.threads;++i){
+            rings.emplace_back(new vio::Ring);
+            if(!rings.back()->init(n)){ std::fprintf(stderr,"io_uring unavailable, using posix reads\n"); opt.io=IO_POSIX; rings.clear(); break; }
+        }
+    }
+    if(opt.io!=IO_URING) opt.depth=1;
+    if(!opt.serve.empty()){
+        if(opt.io==IO_URING){ std::fprintf(stderr,"--serve reads with posix or mmap; using posix\n"); rings.clear(); }
+        vmet::PhaseScope ps(g_metrics, "serve");
+        return serve(opt, reader);
+    }
+
+    // Queries are drawn up front so every thread count and backend answers
+    // the same query set for a given seed.
+    Batch batch(opt, reader);
+    std::mt19937_64 rng{std::random_device{}()};
+    std::uniform_int_distribution<uint32_t> u8(0,255);
+    batch.prefixes.resize(opt.searches*opt.diff);
+    for(auto& x: batch.prefixes) x=(uint8_t)u8(rng);
+    batch.lat_us.resize(opt.searches);
+    if(opt.debug) batch.detail.resize(opt.searches);
+    if(opt.debug && opt.nonces) batch.nonces.resize(opt.searches);
+
+    if(opt.debug){
+        std::printf("searches=%zu difficulty=%d\n", opt.searches, opt.diff);
+        std::printf("Hash Size : %d  Nonce Size : %d  Rec Size : %zu  Elided Prefix : %d\n",
+            HASH_SIZE, NONCE_SIZE, vault.rec_bytes, vault.c);
+        std::printf("Number of Hashes : %llu  File Size : %llu bytes\n",
+            (unsigned long long)nrec, (unsigned long long)(vault.data_off + nrec*vault.rec_bytes));
+        std::printf("Prefix Index : %d bits (%s)  Method : %s\n", vault.index.bits, reader.index_source(), opt.interp ? "interp" : "binary");
+        if(vault.filter.on()) std::printf("Filter : %d bits/record, %.1f MiB\n", vault.filter.bits_per_record(), vault.filter.bytes()/1048576.0);
+        else std::printf("Filter : none\n");
+        std::printf("Threads : %d  IO : %s  Queue Depth : %u  Batch : %zu\n", opt.threads, io_name(opt.io), opt.depth, opt.batch);
+    }
+
+    std::vector<ThreadTotals> totals(opt.threads);
+    const int phase = g_metrics.begin("queries");
+    auto T0=std::chrono::high_resolution_clock::now();
+    {
+        std::vector<std::thread> pool;
+        for(int i=0;i<opt.threads;++i) pool.emplace_back([&,i]{
+            const double t0 = vmet::now_s();
+            if(opt.io==IO_URING) run_uring(batch, totals[i], *rings[i]);
+            else run_sync(batch, totals[i]);
+            const ThreadTotals& t = totals[i];
+            g_metrics.thread("queries", "search", i, {{"wall_s", vmet::now_s()-t0}, {"queries", (double)t.queries},
+                                                      {"seeks", (double)t.seeks}, {"bytes", (double)t.bytes}});
+        });
+        for(auto& th: pool) th.join();
+    }
+    auto T1=std::chrono::high_resolution_clock::now();
+
+    uint64_t total_seeks=0,total_comps=0,total_bytes_read=0;
+    uint64_t total_matches=0,found_q=0,rejected=0,records_read=0,read_errors=0;
+    for(const auto& t: totals){
+        total_seeks+=t.seeks; total_comps+=t.comps; total_bytes_read+=t.bytes;
+        total_matches+=t.matches; found_q+=t.found; rejected+=t.rejected;
+        records_read+=t.records; read_errors+=t.read_errors;
+    }
+    const uint64_t notfound = opt.searches - found_q;
+
+    if(opt.debug){
+        for(size_t q=0;q<opt.searches;++q){
+            const QueryResult& r = batch.detail[q];
+            char hex[7]={0}; for(int i=0;i<3 && i<opt.diff;++i) std::sprintf(hex+2*i,"%02x",batch.prefixes[q*opt.diff+i]);
+            if(r.matches) std::printf("[%zu] %s MATCHES=%llu comps=%llu seeks=%llu\n", q, hex,
+                (unsigned long long)r.matches,(unsigned long long)r.comps,(unsigned long long)r.seeks);
+            else          std::printf("[%zu] %s NOTFOUND comps=%llu seeks=%llu\n", q, hex,
+                (unsigned long long)r.comps,(unsigned long long)r.seeks);
+            if(!batch.nonces.empty() && r.matches){
+                std::printf("    nonces:");
+                for(uint64_t n: batch.nonces[q]) std::printf(" %llu", (unsigned long long)n);
+                std::printf("\n");
+            }
+        }
+    }
+    double total_s = std::chrono::duration<double>(T1-T0).count();
+    double avg_ms  = (opt.searches? (total_s*1000.0/opt.searches):0.0);
+    double qps     = (total_s>0? (opt.searches/total_s):0.0);
+    double avg_bytes_per_search = (opt.searches? (double)total_bytes_read/opt.searches:0.0);
+
+    std::printf("Search Summary: requested=%zu performed=%zu found_queries=%llu total_matches=%llu notfound=%llu\n",
+        opt.searches,opt.searches,(unsigned long long)found_q,(unsigned long long)total_matches,(unsigned long long)notfound);
+    std::printf("total_time=%.6f s avg_ms=%.3f ms searches/sec=%.2f total_seeks=%llu\n",
+        total_s,avg_ms,qps,(unsigned long long)total_seeks);
+    std::printf("avg_seeks_per_search=%.3f total_comps=%llu avg_comps_per_search=%.3f\n",
+        (opt.searches? (double)total_seeks/opt.searches:0.0),
+        (unsigned long long)total_comps,
+        (opt.searches? (double)total_comps/opt.searches:0.0));
+    std::printf("avg_bytes_read_per_search=%.1f\n", avg_bytes_per_search);
+    if(vault.filter.on()) std::printf("filter_rejects=%llu (%d bits/record)\n", (unsigned long long)rejected, vault.filter.bits_per_record());
+    if(opt.nonces) std::printf("records_read=%llu read_errors=%llu\n", (unsigned long long)records_read, (unsigned long long)read_errors);
+
+    // Per-query latency, start of lower bound to end of upper bound (and of
+    // its record reads with --nonces). With queue depth > 1 it includes time
+    // spent waiting behind other queries; with --batch it is the batch's.
+    char extra[96];
+    std::snprintf(extra, sizeof(extra), " threads=%d io=%s queue_depth=%u", opt.threads, io_name(opt.io), opt.depth);
+    Percentiles pc = print_latency(batch.lat_us, extra);
+
+    g_metrics.end(phase, {{"searches_per_s", qps}, {"p50_us", pc.p50}, {"p99_us", pc.p99},
+                          {"p999_us", pc.p999}, {"max_us", pc.max}});
+    vmet::Hist seeks_h, lat_h;
+    for(const auto& t: totals){ seeks_h.add(t.seeks_h); lat_h.add(t.lat_h); }
+    g_metrics.hist("seeks_per_query_log2", seeks_h);
+    g_metrics.hist("latency_us_log2", lat_h);
+    const std::pair<const char*, uint64_t> counts[] = {
+        {"queries", opt.searches}, {"found_queries", found_q}, {"total_matches", total_matches},
+        {"seeks", total_seeks}, {"comparisons", total_comps}, {"bytes_read", total_bytes_read},
+        {"filter_rejects", rejected}, {"records_read", records_read}, {"read_errors", read_errors}};
+    for(auto& c: counts) g_metrics.count(c.first, c.second);
+    return read_errors ? 1 : 0;
+}
+
+}; // struct Engine
+
+} // namespace sx
+
+static Opt parse(int argc, char** argv, vlay::Layout lay){
+    Opt o; const char* s="k:f:s:q:d:x:m:t:B:h";
+    const option l[]={{"k",required_argument,nullptr,'k'},
+                      {"file",required_argument,nullptr,'f'},
+                      {"searches",required_argument,nullptr,'s'},
+                      {"difficulty",required_argument,nullptr,'q'},
+                      {"debug",required_argument,nullptr,'d'},
+                      {"index",required_argument,nullptr,'x'},
+                      {"filter",required_argument,nullptr,'F'},
+                      {"method",required_argument,nullptr,'m'},
+                      {"threads",required_argument,nullptr,'t'},
+                      {"queue-depth",required_argument,nullptr,'Q'},
+                      {"io",required_argument,nullptr,'I'},
+                      {"serve",required_argument,nullptr,'S'},
+                      {"load",required_argument,nullptr,'L'},
+                      {"cache-mb",required_argument,nullptr,'C'},
+                      {"metrics",required_argument,nullptr,'M'},
+                      {"layout",required_argument,nullptr,'Y'},
+                      {"batch",required_argument,nullptr,'B'},
+                      {"nonces",required_argument,nullptr,'N'},
+                      {"help",no_argument,nullptr,'h'},{nullptr,0,nullptr,0}};
+    while(true){
+        int i=0,c=getopt_long(argc,argv,s,l,&i);
+        if(c==-1) break;
+        if(c=='k') o.k=std::max(1,atoi(optarg));
+        else if(c=='f') o.file=optarg;
+        else if(c=='s') o.searches=strtoull(optarg,nullptr,10);
+        else if(c=='q') o.diff=std::max(1,atoi(optarg));
+        else if(c=='d') o.debug=(std::string(optarg)=="true");
+        else if(c=='x') o.index=(std::string(optarg)=="true");
+        else if(c=='F') o.filter=(std::string(optarg)=="true");
+        else if(c=='m' && (std::string(optarg)=="interp" || std::string(optarg)=="binary")) o.interp=(std::string(optarg)=="interp");
+        else if(c=='t') o.threads=std::max(1,atoi(optarg));
+        else if(c=='Q') o.depth=(unsigned)std::min(4096,std::max(1,atoi(optarg)));
+        else if(c=='I' && std::string(optarg)=="posix") o.io=IO_POSIX;
+        else if(c=='I' && std::string(optarg)=="mmap") o.io=IO_MMAP;
+        else if(c=='I' && std::string(optarg)=="uring") o.io=IO_URING;
+        else if(c=='S') o.serve=optarg;
+        else if(c=='L') o.load=optarg;
+        else if(c=='C') o.cache_mb=strtoull(optarg,nullptr,10);
+        else if(c=='M') o.metrics=optarg;
+        else if(c=='B') o.batch=std::min<size_t>(65536,std::max(1,atoi(optarg)));
+        else if(c=='N') o.nonces=(std::string(optarg)=="true");
+        else if(c=='Y') continue;   // picked the engine in main()
+        else { std::fprintf(stderr,"Usage: ./searchx -k K -f FILE -s N -q D [-d true|false] [-x|--index true|false] [-m|--method interp|binary]\n"
+                                   "                 [-t|--threads T] [--io posix|mmap|uring] [--queue-depth Q (uring)] [--filter true|false]\n"
+                                   "                 [-B|--batch N (queries per sorted lookup_batch)] [--nonces true|false (read matching records)]\n"
+                                   "       ./searchx -f FILE --serve SOCKET [--io posix|mmap] [--cache-mb M] [--filter true|false]\n"
+                                   "       ./searchx --load SOCKET -s N -q D [-t CONNECTIONS] [--queue-depth Q]\n"
+                                   "       any mode: [--metrics FILE] (JSON phase timers, counters, histograms)\n"
+                                   "                 [--layout HASH:NONCE] (%s; default: a compressed vault's own, else 10:6)\n",
+                                   vlay::names(vlay::LAYOUTS<sx::Engine>).c_str()); std::exit(1);}
+    }
+    if(o.file.empty() && o.load.empty()){ std::fprintf(stderr,"Missing -f FILE\n"); std::exit(1); }
+    if(o.diff>lay.hash) o.diff=lay.hash;
+    return o;
+}
@@ -0,0 +1,179 @@
+// vault_filter.h - blocked Bloom filter sidecar (<vault>.bloom) over the full
+// hashes of a vault, so searchx can turn away absent exact-hash lookups
+// without reading the vault.
+//
+// The filter is an array of 64-byte (one cache line) blocks of eight 64-bit
+// words. A key picks one block and sets one bit in each of its words, so a
+// lookup touches one cache line. The block is the key's first 8 hash bytes
+// scaled to the block count, which keeps it monotone in the sort order:
+// the writers of a vault (merge partitions, buckets, shards) each own a
+// contiguous key range and so a contiguous block range, and only the blocks
+// at the edges of a merge partition are shared. When the block count is a
+// multiple of 2^bits, the blocks of every top-`bits` hash bucket are exactly
+// its own. Bit positions come from a mix of all hash bytes.
+//
+// vaultx fills the filter while it writes the final vault, so it costs no
+// extra pass, and writes it next to the vault; the header ties it to the
+// vault's layout, size and mtime like the searchx index sidecar. About 3%
+// of absent keys pass at 8 bits per record, 0.4% at 12.
+//
+// Layout-free: the hash size is a template parameter. Include after
+// vault_io.h.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vflt {
+
+static const char MAGIC[8] = {'V','A','U','L','T','X','B','1'};
+static const uint32_t VERSION = 1;
+static const size_t BLOCK_WORDS = 8;            // 64-byte blocks
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint8_t hash_size, nonce_size, bits_per_record, pad0;
+    uint64_t records, blocks, vault_size;
+    int64_t vault_mtime;
+    uint8_t pad[16];
+};
+static_assert(sizeof(Header) == 64, "filter header is 64 bytes");
+
+static inline std::string sidecar(const std::string& vault) { return vault + ".bloom"; }
+
+// First 8 hash bytes, big-endian: orders like the hash itself.
+template <int H>
+static inline uint64_t head64(const uint8_t* h) {
+    static_assert(H >= 8, "hashes are at least 8 bytes");
+    uint64_t x;
+    std::memcpy(&x, h, 8);
+    return __builtin_bswap64(x);
+}
+
+// All hash bytes folded into 64 well-mixed bits.
+template <int H>
+static inline uint64_t mix64(const uint8_t* h) {
+    uint64_t x = 0;
+    for (int i = 0; i < H; i += 8) {
+        uint64_t w = 0;
+        std::memcpy(&w, h + i, H - i < 8 ? H - i : 8);
+        x = (x ^ w) * 0x9E3779B97F4A7C15ULL;
+    }
+    x ^= x >> 32; x *= 0xD6E8FEB86659FD93ULL;
+    x ^= x >> 32;
+    return x;
+}
+
+class Filter {
+public:
+    bool on() const { return blocks_ != 0; }
+    uint64_t blocks() const { return blocks_; }
+    int bits_per_record() const { return bits_; }
+    size_t bytes() const { return words_.size() * sizeof(uint64_t); }
+
+    // Zeroed filter for `records` keys, rounded up to a multiple of `align`
+    // blocks (a power of two; see the file comment).
+    void init(uint64_t records, int bits_per_record, uint64_t align) {
+        bits_ = bits_per_record;
+        blocks_ = (records * (uint64_t)bits_per_record + 511) / 512;
+        blocks_ = (std::max<uint64_t>(1, blocks_) + align - 1) / align * align;
+        words_.assign(blocks_ * BLOCK_WORDS, 0);
+    }
+
+    template <int H>
+    uint64_t block_of(const uint8_t* h) const {
+        return (uint64_t)(((unsigned __int128)head64<H>(h) * blocks_) >> 64);
+    }
+
+    // `shared`: another thread may add to the same block concurrently.
+    template <int H>
+    void add(const uint8_t* h, bool shared = false) {
+        uint64_t* w = &words_[block_of<H>(h) * BLOCK_WORDS];
+        const uint64_t m = mix64<H>(h);
+        for (size_t i = 0; i < BLOCK_WORDS; ++i) {
+            const uint64_t bit = 1ULL << ((m * SALT[i]) >> 58);
+            if (shared) __atomic_fetch_or(&w[i], bit, __ATOMIC_RELAXED);
+            else w[i] |= bit;
+        }
+    }
+
+    // False only if the key is certainly not in the vault.
+    template <int H>
+    bool may_contain(const uint8_t* h) const {
+        const uint64_t* w = &words_[block_of<H>(h) * BLOCK_WORDS];
+        const uint64_t m = mix64<H>(h);
+        uint64_t miss = 0;
+        for (size_t i = 0; i < BLOCK_WORDS; ++i) miss |= ~w[i] & (1ULL << ((m * SALT[i]) >> 58));
+        return miss == 0;
+    }
+
+    template <int H>
+    void prefetch(const uint8_t* h) const { __builtin_prefetch(&words_[block_of<H>(h) * BLOCK_WORDS]); }
+
+    // Store blocks [first, first+n) at their place in the sidecar `fd`.
+    bool write_blocks(int fd, uint64_t first, uint64_t n) const {
+        const size_t b = BLOCK_WORDS * sizeof(uint64_t);
+        return vio::pwrite_all(fd, &words_[first * BLOCK_WORDS], n * b, (off_t)(sizeof(Header) + first * b));
+    }
+
+    // Header for the finished vault at `vault_path`; written last, so a
+    // sidecar whose writer died midway never matches.
+    bool write_header(int fd, const std::string& vault_path, int hash_size, int nonce_size, uint64_t records) const {
+        struct stat st{};
+        if (::stat(vault_path.c_str(), &st) != 0) return false;
+        Header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, MAGIC, 8);
+        h.version = VERSION;
+        h.hash_size = (uint8_t)hash_size; h.nonce_size = (uint8_t)nonce_size; h.bits_per_record = (uint8_t)bits_;
+        h.records = records; h.blocks = blocks_;
+        h.vault_size = (uint64_t)st.st_size; h.vault_mtime = (int64_t)st.st_mtime;
+        return vio::pwrite_all(fd, &h, sizeof(h), 0);
+    }
+
+    // Whole filter next to a finished vault.
+    bool save(const std::string& path, const std::string& vault_path, int hash_size, int nonce_size, uint64_t records) const {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        const bool ok = write_blocks(fd, 0, blocks_) && write_header(fd, vault_path, hash_size, nonce_size, records);
+        return ::close(fd) == 0 && ok;
+    }
+
+    // Load a sidecar written for exactly this vault; false (and no filter)
+    // if it is missing, stale or for another layout.
+    bool load(const std::string& path, int hash_size, int nonce_size, uint64_t records, uint64_t vault_size, int64_t vault_mtime) {
+        blocks_ = 0; words_.clear();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        Header h;
+        bool ok = vio::pread_all(fd, &h, sizeof(h), 0) && std::memcmp(h.magic, MAGIC, 8) == 0 && h.version == VERSION &&
+                  h.hash_size == hash_size && h.nonce_size == nonce_size && h.records == records &&
+                  h.vault_size == vault_size && h.vault_mtime == vault_mtime && h.blocks > 0;
+        if (ok) {
+            words_.resize(h.blocks * BLOCK_WORDS);
+            ok = vio::pread_all(fd, words_.data(), bytes(), (off_t)sizeof(Header));
+        }
+        ::close(fd);
+        if (ok) { blocks_ = h.blocks; bits_ = h.bits_per_record; }
+        else words_.clear();
+        return ok;
+    }
+
+private:
+    // Odd multipliers, one per word (as in split-block Bloom filters).
+    static constexpr uint64_t SALT[BLOCK_WORDS] = {
+        0x47b6137b44974d91ULL, 0x8824ad5ba2b7289dULL, 0x705495c72df1424bULL, 0x9efc49475c6bfb31ULL,
+        0x2df1424b9efc4947ULL, 0x5c6bfb3147b6137bULL, 0x44974d918824ad5bULL, 0xa2b7289d705495c7ULL};
+    uint64_t blocks_ = 0;
+    int bits_ = 0;
+    std::vector<uint64_t, vio::AlignedAllocator<uint64_t>> words_;
+};
+
+} // namespace vflt
@@ -0,0 +1,126 @@
+// vault_format.h - on-disk layout of a compressed (prefix-elided) vault,
+// shared by vaultx (writer) and searchx (reader).
+//
+// A sorted vault of uniform hashes spends its first c hash bytes mostly
+// restating the record's position. With --compression c > 0, vaultx drops
+// those c bytes from every record and stores a directory instead:
+//
+//   [Header, 64 bytes][dir: 2^(8c)+1 x uint64][pad to 4 KiB][records]
+//
+// dir[p] is the index of the first record whose leading c hash bytes
+// (big-endian) are >= p, and dir[2^(8c)] == records. Bucket p is therefore
+// records [dir[p], dir[p+1]), and every record in it starts with prefix p.
+// Each stored record is hash[c..HASH_SIZE) followed by the nonce. Integers
+// are little-endian (native on the x86 nodes we run on). A file without
+// the magic is a plain vault of HASH_SIZE+NONCE_SIZE byte records. The
+// layout-dependent helpers take the layout as template arguments <H, N>.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+namespace vfmt {
+
+static const char MAGIC[8] = {'V', 'A', 'U', 'L', 'T', 'X', 'C', '1'};
+static const uint32_t VERSION = 1;
+static const int MAX_PREFIX = 3;       // 2^24+1 directory entries (128 MiB) at most
+static const uint64_t DATA_ALIGN = 4096;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint8_t hash_size, nonce_size, prefix_bytes, pad0;
+    uint32_t rec_bytes;                // stored bytes per record
+    uint32_t pad1;
+    uint64_t records;
+    uint64_t dir_offset;
+    uint64_t data_offset;
+    uint8_t reserved[16];
+};
+static_assert(sizeof(Header) == 64, "vault header is 64 bytes");
+
+static inline uint64_t dir_entries(int c) { return (1ULL << (8 * c)) + 1; }
+template <int H, int N>
+static inline size_t rec_bytes(int c) { return (size_t)(H - c + N); }
+static inline uint64_t data_offset(int c) {
+    uint64_t end = sizeof(Header) + dir_entries(c) * sizeof(uint64_t);
+    return (end + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+}
+
+// Leading c hash bytes as a big-endian integer (same order as cmp_hash).
+static inline uint32_t prefix_of(const uint8_t* hash, int c) {
+    uint32_t p = 0;
+    for (int i=0; i<c; ++i) p = (p << 8) | hash[i];
+    return p;
+}
+
+template <int H, int N>
+static inline void encode(const uint8_t* rec, int c, uint8_t* dst) {
+    std::memcpy(dst, rec + c, rec_bytes<H, N>(c));
+}
+
+// Rebuild a full H+N byte record from its stored bytes.
+template <int H, int N>
+static inline void decode(const uint8_t* src, uint32_t prefix, int c, uint8_t* rec) {
+    for (int i=c-1; i>=0; --i) { rec[i] = (uint8_t)(prefix & 0xFF); prefix >>= 8; }
+    std::memcpy(rec + c, src, rec_bytes<H, N>(c));
+}
+
+template <int H, int N>
+static inline Header make_header(int c, uint64_t records) {
+    Header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.hash_size = H;
+    h.nonce_size = N;
+    h.prefix_bytes = (uint8_t)c;
+    h.rec_bytes = (uint32_t)rec_bytes<H, N>(c);
+    h.records = records;
+    h.dir_offset = sizeof(Header);
+    h.data_offset = data_offset(c);
+    return h;
+}
+
+static inline bool pread_exact(int fd, void* buf, size_t len, uint64_t off) {
+    char* p = static_cast<char*>(buf);
+    while (len > 0) {
+        ssize_t n = ::pread(fd, p, len, (off_t)off);
+        if (n <= 0) return false;
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return true;
+}
+
+// Bytes read before EOF (fewer than len only at EOF), or -1 on a read error.
+static inline ssize_t pread_upto(int fd, void* buf, size_t len, uint64_t off) {
+    char* p = static_cast<char*>(buf);
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = ::pread(fd, p + got, len - got, (off_t)(off + got));
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+// 1 = compressed vault (h and dir filled), 0 = plain vault (no magic, or a
+// file shorter than a header), -1 = the header could not be read, does not
+// match layout H:N or is damaged.
+template <int H, int N>
+static int read_header(int fd, Header& h, std::vector<uint64_t>& dir) {
+    const ssize_t got = pread_upto(fd, &h, sizeof(h), 0);
+    if (got < 0) return -1;
+    if ((size_t)got < sizeof(h) || std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0) return 0;
+    if (h.version != VERSION || h.hash_size != H || h.nonce_size != N ||
+        h.prefix_bytes < 1 || h.prefix_bytes > MAX_PREFIX || h.rec_bytes != rec_bytes<H, N>(h.prefix_bytes)) return -1;
+    dir.resize(dir_entries(h.prefix_bytes));
+    if (!pread_exact(fd, dir.data(), dir.size() * sizeof(uint64_t), h.dir_offset)) return -1;
+    if (dir.back() != h.records) return -1;
+    return 1;
+}
+
+} // namespace vfmt
@@ -0,0 +1,397 @@
+// vault_io.h - file I/O for vaultx and searchx: buffered POSIX or io_uring,
+// with optional O_DIRECT.
+//
+// Every bulk transfer goes through an IoQueue (one per thread). submit()
+// queues a read or write and returns a ticket; wait() blocks for that
+// ticket. The POSIX backend does the transfer inside submit(), so callers
+// that keep several tickets in flight just get synchronous behaviour. The
+// io_uring backend (raw syscalls, no liburing) really overlaps them, which
+// gives run readers their read-ahead and writers their write-behind.
+//
+// O_DIRECT bypasses the page cache. It needs buffers, offsets and lengths
+// that are multiples of ALIGN. Records are 16 bytes and ALIGN is a multiple
+// of 16, so record ranges only need rounding at their ends. Unaligned head
+// and tail bytes go through a second, buffered fd on the same file
+// (OutFile::fd).
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace vio {
+
+static const size_t ALIGN = 4096;
+
+static inline size_t align_up(size_t v)   { return (v + ALIGN - 1) / ALIGN * ALIGN; }
+static inline size_t align_down(size_t v) { return v / ALIGN * ALIGN; }
+
+// Process-wide I/O tallies for --metrics (metrics.h): relaxed atomics, one
+// update per transfer. inflight is bytes submitted and not yet completed.
+struct IoStats {
+    std::atomic<uint64_t> read_bytes{0}, write_bytes{0}, reads{0}, writes{0};
+    std::atomic<uint64_t> inflight{0}, inflight_peak{0};
+    void done(bool write, size_t n) {
+        (write ? write_bytes : read_bytes).fetch_add(n, std::memory_order_relaxed);
+        (write ? writes : reads).fetch_add(1, std::memory_order_relaxed);
+    }
+    void enter(size_t n) {
+        uint64_t v = inflight.fetch_add(n, std::memory_order_relaxed) + n;
+        uint64_t p = inflight_peak.load(std::memory_order_relaxed);
+        while (v > p && !inflight_peak.compare_exchange_weak(p, v, std::memory_order_relaxed)) {}
+    }
+    void leave(size_t n) { inflight.fetch_sub(n, std::memory_order_relaxed); }
+};
+inline IoStats io_stats;
+
+static inline bool pwrite_all(int fd, const void* data, size_t len, off_t off) {
+    const char* p = static_cast<const char*>(data);
+    const size_t total = len;
+    io_stats.enter(total);
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, p, len, off);
+        if (n <= 0) break;
+        p += n; len -= (size_t)n; off += n;
+    }
+    io_stats.leave(total);
+    io_stats.done(true, total - len);
+    return len == 0;
+}
+
+static inline bool pread_all(int fd, void* data, size_t len, off_t off) {
+    char* p = static_cast<char*>(data);
+    const size_t total = len;
+    io_stats.enter(total);
+    while (len > 0) {
+        ssize_t n = ::pread(fd, p, len, off);
+        if (n <= 0) break;
+        p += n; len -= (size_t)n; off += n;
+    }
+    io_stats.leave(total);
+    io_stats.done(false, total - len);
+    return len == 0;
+}
+
+// Reads until len bytes or EOF; returns bytes read or -errno.
+static inline ssize_t pread_upto(int fd, void* data, size_t len, off_t off) {
+    char* p = static_cast<char*>(data);
+    size_t got = 0;
+    io_stats.enter(len);
+    ssize_t err = 0;
+    while (got < len) {
+        ssize_t n = ::pread(fd, p + got, len - got, off + (off_t)got);
+        if (n < 0) { err = -errno; break; }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    io_stats.leave(len);
+    io_stats.done(false, got);
+    return err ? err : (ssize_t)got;
+}
+
+// Page-aligned allocator so record buffers can be handed to O_DIRECT as-is.
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, ALIGN, align_up(std::max<size_t>(1, n * sizeof(T)))) != 0) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { std::free(p); }
+    // Skip value-initialisation on resize(): buffers are always filled before use.
+    template <typename U, typename... Args> void construct(U* p, Args&&... args) {
+        if (sizeof...(Args)) ::new ((void*)p) U(std::forward<Args>(args)...);
+    }
+    template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+struct Config {
+    bool uring = false;   // io_uring backend instead of blocking POSIX calls
+    bool direct = false;  // O_DIRECT for run files, merge input/output and verify
+    unsigned depth = 4;   // transfers kept in flight per stream (io_uring only)
+};
+
+// Minimal io_uring: one SQ/CQ pair, IORING_OP_READ/WRITE only.
+struct Ring {
+    int fd = -1;
+    unsigned entries = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    void* sq_ptr = MAP_FAILED; size_t sq_len = 0;
+    void* cq_ptr = MAP_FAILED; size_t cq_len = 0;
+    size_t sqes_len = 0;
+    unsigned queued = 0;
+
+    bool init(unsigned n) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = (int)::syscall(__NR_io_uring_setup, n, &p);
+        if (fd < 0) return false;
+        entries = p.sq_entries;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+        sq_ptr = ::mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) return false;
+        cq_ptr = single ? sq_ptr
+                        : ::mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        void* s = ::mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe*>(s);
+        char* sq = static_cast<char*>(sq_ptr);
+        char* cq = static_cast<char*>(cq_ptr);
+        sq_head  = (unsigned*)(sq + p.sq_off.head);
+        sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+        sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + p.sq_off.array);
+        cq_head  = (unsigned*)(cq + p.cq_off.head);
+        cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+        cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes     = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+    ~Ring() {
+        if (sqes) ::munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED) ::munmap(sq_ptr, sq_len);
+        if (fd >= 0) ::close(fd);
+    }
+    // Caller guarantees a free SQ slot (in-flight < entries).
+    void push(bool write, int file, void* buf, size_t len, off_t off, uint64_t tag) {
+        queue(write, file, buf, len, off, tag);
+        flush();
+    }
+    // queue() fills an SQE without a syscall; flush() submits all queued
+    // ones with one io_uring_enter, for callers that batch many small reads.
+    void queue(bool write, int file, void* buf, size_t len, off_t off, uint64_t tag) {
+        unsigned tail = *sq_tail;
+        unsigned idx = tail & *sq_mask;
+        io_uring_sqe* e = &sqes[idx];
+        std::memset(e, 0, sizeof(*e));
+        e->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        e->fd = file;
+        e->addr = (uint64_t)(uintptr_t)buf;
+        e->len = (uint32_t)len;
+        e->off = (uint64_t)off;
+        e->user_data = tag;
+        sq_array[idx] = idx;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++queued;
+    }
+    void flush() {
+        if (queued) ::syscall(__NR_io_uring_enter, fd, queued, 0, 0, nullptr, 0);
+        queued = 0;
+    }
+    // Block for at least one completion and hand every ready one to fn(tag, res).
+    template <typename Fn> void reap(Fn&& fn) {
+        unsigned head = *cq_head;
+        while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            ::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& c = cqes[head & *cq_mask];
+            fn(c.user_data, c.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+
+class IoQueue {
+public:
+    IoQueue(const Config& cfg, unsigned max_inflight) {
+        if (cfg.uring) {
+            unsigned n = 1;
+            while (n < std::min(4096u, std::max(8u, max_inflight))) n <<= 1;
+            ring_.reset(new Ring);
+            if (!ring_->init(n)) ring_.reset();
+        }
+    }
+    bool uring() const { return ring_ != nullptr; }
+
+    uint64_t submit(bool write, int fd, void* buf, size_t len, off_t off) {
+        uint64_t t = next_++;
+        if (!ring_) {
+            ssize_t r = write ? (pwrite_all(fd, buf, len, off) ? (ssize_t)len : -EIO)
+                              : pread_upto(fd, buf, len, off);
+            done_[t] = r;
+            return t;
+        }
+        while (pending_.size() >= ring_->entries) reap();
+        io_stats.enter(len);
+        pending_[t] = Op{write, fd, buf, len, off};
+        ring_->push(write, fd, buf, len, off, t);
+        return t;
+    }
+
+    // Bytes transferred or -errno. A short io_uring read means EOF; a short
+    // write is finished synchronously.
+    ssize_t wait(uint64_t t) {
+        auto it = done_.find(t);
+        while (it == done_.end()) { reap(); it = done_.find(t); }
+        ssize_t r = it->second;
+        done_.erase(it);
+        return r;
+    }
+
+private:
+    struct Op { bool write; int fd; void* buf; size_t len; off_t off; };
+    void reap() {
+        ring_->reap([&](uint64_t tag, int res) {
+            auto it = pending_.find(tag);
+            ssize_t r = res;
+            if (it != pending_.end()) {
+                const Op& op = it->second;
+                io_stats.leave(op.len);
+                if (res > 0) io_stats.done(op.write, (size_t)res);
+                if (op.write && res >= 0 && (size_t)res < op.len &&
+                    !pwrite_all(op.fd, (char*)op.buf + res, op.len - res, op.off + res)) r = -EIO;
+                else if (op.write && res >= 0) r = (ssize_t)op.len;
+                pending_.erase(it);
+            }
+            done_[tag] = r;
+        });
+    }
+    std::unique_ptr<Ring> ring_;
+    uint64_t next_ = 1;
+    std::unordered_map<uint64_t, Op> pending_;
+    std::unordered_map<uint64_t, ssize_t> done_;
+};
+
+// An output file opened twice: dfd for aligned bulk transfers (O_DIRECT when
+// asked and supported) and fd, always buffered, for unaligned heads/tails.
+struct OutFile {
+    int fd = -1, dfd = -1;
+    bool direct() const { return dfd != fd; }
+    void close() {
+        if (dfd >= 0 && dfd != fd) ::close(dfd);
+        if (fd >= 0) ::close(fd);
+        fd = dfd = -1;
+    }
+};
+
+static inline OutFile open_out(const std::string& path, bool trunc, bool direct) {
+    OutFile f;
+    f.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (trunc ? O_TRUNC : 0), 0644);
+    f.dfd = f.fd;
+    if (f.fd >= 0 && direct) {
+        int d = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+        if (d >= 0) f.dfd = d; // filesystems without O_DIRECT keep buffered I/O
+    }
+    return f;
+}
+
+static inline int open_in(const std::string& path, bool direct) {
+    int fd = direct ? ::open(path.c_str(), O_RDONLY | O_DIRECT) : -1;
+    return fd >= 0 ? fd : ::open(path.c_str(), O_RDONLY);
+}
+
+static inline bool is_direct(int fd) { return (::fcntl(fd, F_GETFL) & O_DIRECT) != 0; }
+
+// Sequential writer over [off, ...) of an OutFile with write-behind: `depth`
+// buffers of `cap` bytes rotate, and a buffer is only reused once its write
+// has completed. On a direct file the bytes up to the first ALIGN boundary
+// and the final partial buffer go through the buffered fd, so every direct
+// transfer stays aligned.
+class SeqWriter {
+public:
+    SeqWriter(IoQueue& q, const OutFile& f, off_t off, size_t cap, unsigned depth)
+        : q_(q), f_(f), off_(off), cap_(f.direct() ? std::max(ALIGN, align_down(cap)) : std::max<size_t>(1, cap)),
+          bufs_(std::max(1u, depth)), tickets_(bufs_.size(), 0) {
+        for (auto& b: bufs_) b.resize(cap_);
+        if (f_.direct() && off_ % (off_t)ALIGN) head_ = ALIGN - (size_t)(off_ % (off_t)ALIGN);
+    }
+    bool append(const void* data, size_t len) {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0 && ok_) {
+            if (head_ > 0) { // unaligned prefix: buffered, synchronous
+                size_t n = std::min(head_, len);
+                ok_ = pwrite_all(f_.fd, p, n, off_);
+                off_ += (off_t)n; head_ -= n; p += n; len -= n;
+                continue;
+            }
+            size_t n = std::min(cap_ - fill_, len);
+            std::memcpy(bufs_[cur_].data() + fill_, p, n);
+            fill_ += n; p += n; len -= n;
+            if (fill_ == cap_) submit_current(f_.dfd);
+        }
+        return ok_;
+    }
+    bool finish() {
+        const auto t0 = std::chrono::steady_clock::now();
+        if (fill_ > 0 && ok_) {
+            ok_ = pwrite_all(f_.fd, bufs_[cur_].data(), fill_, off_);
+            off_ += (off_t)fill_;
+            fill_ = 0;
+        }
+        for (auto& t: tickets_) if (t) { if (q_.wait(t) < 0) ok_ = false; t = 0; }
+        io_s_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        return ok_;
+    }
+    // Seconds spent submitting and waiting for writes (--metrics).
+    double io_seconds() const { return io_s_; }
+private:
+    void submit_current(int fd) {
+        const auto t0 = std::chrono::steady_clock::now();
+        tickets_[cur_] = q_.submit(true, fd, bufs_[cur_].data(), fill_, off_);
+        off_ += (off_t)fill_;
+        fill_ = 0;
+        cur_ = (cur_ + 1) % bufs_.size();
+        if (tickets_[cur_]) { if (q_.wait(tickets_[cur_]) < 0) ok_ = false; tickets_[cur_] = 0; }
+        io_s_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+    IoQueue& q_;
+    OutFile f_;
+    off_t off_;
+    size_t cap_;
+    std::vector<std::vector<char, AlignedAllocator<char>>> bufs_;
+    std::vector<uint64_t> tickets_;
+    size_t cur_ = 0, fill_ = 0, head_ = 0;
+    bool ok_ = true;
+    double io_s_ = 0;
+};
+
+// Write an already-aligned buffer (e.g. a whole run) at offset 0 of f:
+// aligned chunks go out `depth` at a time via dfd, the tail via fd.
+static inline bool write_buffer(IoQueue& q, const OutFile& f, const void* data, size_t len, unsigned depth,
+                         size_t chunk = 8u << 20) {
+    const char* p = static_cast<const char*>(data);
+    const size_t bulk = f.direct() ? align_down(len) : len;
+    std::vector<uint64_t> inflight;
+    bool ok = true;
+    for (size_t off = 0; off < bulk; off += chunk) {
+        if (inflight.size() >= std::max(1u, depth)) {
+            if (q.wait(inflight.front()) < 0) ok = false;
+            inflight.erase(inflight.begin());
+        }
+        inflight.push_back(q.submit(true, f.dfd, (void*)(p + off), std::min(chunk, bulk - off), (off_t)off));
+    }
+    for (uint64_t t: inflight) if (q.wait(t) < 0) ok = false;
+    if (bulk < len && !pwrite_all(f.fd, p + bulk, len - bulk, (off_t)bulk)) ok = false;
+    return ok;
+}
+
+} // namespace vio
@@ -0,0 +1,133 @@
+// vault_layout.h - the record layouts vaultx and searchx are built for, the
+// Record type, and the fixed-width key compare they share.
+//
+// A layout is (HASH_SIZE, NONCE_SIZE). The layout-dependent code of each
+// tool is a class template over the two sizes (vx::Engine, sx::Engine), so
+// they are compile-time constants, and LAYOUTS lists the instantiations: it
+// is both the runtime dispatch table and the list --help prints. main()
+// picks an entry at startup: --layout H:N, or for searchx the sizes stored
+// in a compressed vault's header. Plain vaults carry no header, so they are
+// read with --layout or the default. vrd::open_any() dispatches the same
+// way over vrd::Opener, so a vault opens as the layout it was written in.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace vlay {
+
+struct Layout { int hash, nonce; };
+
+static const Layout DEFAULT_LAYOUT = {10, 6};
+
+// One dispatch entry: the layout and its instantiation's entry point.
+template <typename Fn>
+struct Entry { int hash, nonce; Fn fn; };
+
+// Every layout the tools are built for, as {hash, nonce, &E<hash,nonce>::run}.
+// Adding a line here instantiates the layout in each tool and its --help.
+template <template <int, int> class E>
+inline constexpr Entry<decltype(&E<10, 6>::run)> LAYOUTS[] = {
+    {10, 6, &E<10, 6>::run},
+    {12, 4, &E<12, 4>::run},
+    {26, 6, &E<26, 6>::run},
+};
+
+template <typename Fn, size_t K>
+static inline const Entry<Fn>* find(const Entry<Fn> (&table)[K], Layout l) {
+    for (const Entry<Fn>& e: table)
+        if (e.hash == l.hash && e.nonce == l.nonce) return &e;
+    return nullptr;
+}
+
+// "10:6, 12:4, 26:6": the layouts of a table, for --help and errors.
+template <typename Fn, size_t K>
+static inline std::string names(const Entry<Fn> (&table)[K]) {
+    std::string s;
+    for (const Entry<Fn>& e: table)
+        s += (s.empty() ? "" : ", ") + std::to_string(e.hash) + ":" + std::to_string(e.nonce);
+    return s;
+}
+
+static inline bool parse(const char* s, Layout& l) {
+    char* end = nullptr;
+    const long h = std::strtol(s, &end, 10);
+    if (end == s || *end != ':') return false;
+    const char* n0 = end + 1;
+    const long n = std::strtol(n0, &end, 10);
+    if (end == n0 || *end) return false;
+    l.hash = (int)h; l.nonce = (int)n;
+    return true;
+}
+
+// Value of --name VALUE / --name=VALUE, or of -s VALUE when `s` is given,
+// read straight from argv so main() can dispatch before the engine's getopt.
+static inline const char* find_arg(int argc, char** argv, const char* name, char s = 0) {
+    const size_t len = std::strlen(name);
+    for (int i=1; i<argc; ++i) {
+        const char* a = argv[i];
+        if (std::strcmp(a, "--") == 0) break;
+        if (a[0] == '-' && a[1] == '-' && std::strncmp(a + 2, name, len) == 0) {
+            if (a[2 + len] == '=') return a + 3 + len;
+            if (!a[2 + len] && i + 1 < argc) return argv[i + 1];
+        }
+        if (s && a[0] == '-' && a[1] == s) return a[2] ? a + 2 : (i + 1 < argc ? argv[i + 1] : nullptr);
+    }
+    return nullptr;
+}
+
+// Sizes recorded in a compressed vault's header (vault_format.h: magic[8],
+// version u32, hash_size u8, nonce_size u8). False for a plain vault.
+static inline bool from_header(const char* path, Layout& l) {
+    uint8_t h[14];
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    const bool ok = ::pread(fd, h, sizeof(h), 0) == (ssize_t)sizeof(h) && std::memcmp(h, "VAULTXC1", 8) == 0;
+    ::close(fd);
+    if (ok) { l.hash = h[12]; l.nonce = h[13]; }
+    return ok;
+}
+
+// Compare two N-byte big-endian keys as 64-, 32-, 16- and 8-bit words: N is
+// a constant, so this unrolls into a few loads, bswaps and compares instead
+// of a memcmp call.
+template <int N>
+static inline int cmp_be(const uint8_t* a, const uint8_t* b) {
+    if constexpr (N >= 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a, 8); std::memcpy(&y, b, 8);
+        if (x != y) return __builtin_bswap64(x) < __builtin_bswap64(y) ? -1 : 1;
+        return cmp_be<N - 8>(a + 8, b + 8);
+    } else if constexpr (N >= 4) {
+        uint32_t x, y;
+        std::memcpy(&x, a, 4); std::memcpy(&y, b, 4);
+        if (x != y) return __builtin_bswap32(x) < __builtin_bswap32(y) ? -1 : 1;
+        return cmp_be<N - 4>(a + 4, b + 4);
+    } else if constexpr (N >= 2) {
+        uint16_t x, y;
+        std::memcpy(&x, a, 2); std::memcpy(&y, b, 2);
+        if (x != y) return __builtin_bswap16(x) < __builtin_bswap16(y) ? -1 : 1;
+        return cmp_be<N - 2>(a + 2, b + 2);
+    } else if constexpr (N == 1) {
+        return (int)a[0] - (int)b[0];
+    } else {
+        return 0;
+    }
+}
+
+// One vault record: the (truncated) BLAKE3 hash, then the little-endian nonce.
+template <int H, int N>
+struct Record {
+    uint8_t hash[H];
+    uint8_t nonce[N];
+};
+
+template <int H, int N>
+static inline bool rec_less(const Record<H, N>& a, const Record<H, N>& b) { return cmp_be<H>(a.hash, b.hash) < 0; }
+
+} // namespace vlay
@@ -0,0 +1,185 @@
+// vault_mem.h - record-buffer arena for vaultx: huge pages, NUMA placement
+// and thread pinning.
+//
+// The build cycles a fixed set of record buffers, so they are carved out of
+// one mapping made up front rather than one heap vector each. The mapping
+// is tried with explicit huge pages from the hugetlb pool (1 GiB, then
+// 2 MiB) and otherwise falls back to normal pages advised MADV_HUGEPAGE so
+// transparent huge pages can back it. Nothing is zero-filled beyond what the
+// kernel does on first fault.
+//
+// With pinning on, each buffer is cut into one contiguous part per NUMA node
+// and every part is mbind()-ed to its node. Generator and radix-sort threads
+// split a buffer into T contiguous slices, so thread th of T works inside
+// part th*nodes/T; pin(th, T) moves it onto a CPU of that node, keeping its
+// slice node-local. Topology comes from /sys and mbind is the raw syscall,
+// so libnuma is not needed.
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace vmem {
+
+enum HugeMode { HUGE_OFF, HUGE_AUTO, HUGE_2M, HUGE_1G };
+
+static inline bool parse_huge(const std::string& s, HugeMode& m) {
+    if (s == "off") m = HUGE_OFF;
+    else if (s == "auto") m = HUGE_AUTO;
+    else if (s == "2m") m = HUGE_2M;
+    else if (s == "1g") m = HUGE_1G;
+    else return false;
+    return true;
+}
+
+static inline const char* huge_name(HugeMode m) {
+    return m == HUGE_OFF ? "off" : m == HUGE_2M ? "2m" : m == HUGE_1G ? "1g" : "auto";
+}
+
+// "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+static inline std::vector<int> parse_cpulist(const std::string& s) {
+    std::vector<int> out;
+    size_t i = 0;
+    while (i < s.size()) {
+        size_t end = s.find(',', i);
+        if (end == std::string::npos) end = s.size();
+        const std::string part = s.substr(i, end - i);
+        const size_t dash = part.find('-');
+        if (!part.empty() && part[0] >= '0' && part[0] <= '9') {
+            const int lo = std::stoi(part), hi = dash == std::string::npos ? lo : std::stoi(part.substr(dash + 1));
+            for (int c = lo; c <= hi; ++c) out.push_back(c);
+        }
+        i = end + 1;
+    }
+    return out;
+}
+
+// Online NUMA nodes and their CPUs; one node holding every CPU when /sys
+// has no node directory (non-NUMA kernels, containers).
+struct Topology {
+    std::vector<int> node;                 // node ids, in order
+    std::vector<std::vector<int>> cpus;    // cpus[i] belong to node[i]
+    static Topology detect() {
+        Topology t;
+        std::string line;
+        std::ifstream online("/sys/devices/system/node/online");
+        if (std::getline(online, line))
+            for (int n: parse_cpulist(line)) {
+                std::ifstream cl("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+                std::string cpus;
+                if (std::getline(cl, cpus) && !parse_cpulist(cpus).empty()) {
+                    t.node.push_back(n);
+                    t.cpus.push_back(parse_cpulist(cpus));
+                }
+            }
+        if (t.node.empty()) {
+            t.node.push_back(0);
+            t.cpus.emplace_back();
+            const long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+            for (int c = 0; c < (n > 0 ? n : 1); ++c) t.cpus[0].push_back(c);
+        }
+        return t;
+    }
+    int nodes() const { return (int)node.size(); }
+};
+
+// One anonymous mapping; see the file comment for the page-size fallbacks.
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() { release(); }
+
+    bool init(size_t bytes, HugeMode mode) {
+        release();
+        const size_t MB2 = 2u << 20, GB1 = 1u << 30;
+        struct Try { size_t page; int flags; const char* name; };
+        std::vector<Try> tries;
+        if (mode == HUGE_1G || (mode == HUGE_AUTO && bytes >= GB1))
+            tries.push_back({GB1, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), "1g"});
+        if (mode != HUGE_OFF) tries.push_back({MB2, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), "2m"});
+        tries.push_back({mode == HUGE_OFF ? (size_t)::sysconf(_SC_PAGESIZE) : MB2, 0, mode == HUGE_OFF ? "4k" : "thp"});
+        for (const Try& t: tries) {
+            const size_t len = (std::max<size_t>(1, bytes) + t.page - 1) / t.page * t.page;
+            void* p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | t.flags, -1, 0);
+            if (p == MAP_FAILED) continue;
+            if (!t.flags && mode != HUGE_OFF) ::madvise(p, len, MADV_HUGEPAGE);
+            base_ = static_cast<char*>(p); len_ = len; page_ = t.page; pages_ = t.name;
+            return true;
+        }
+        return false;
+    }
+    void release() {
+        if (base_) ::munmap(base_, len_);
+        base_ = nullptr; len_ = 0;
+    }
+    char* data() const { return base_; }
+    size_t size() const { return len_; }
+    size_t page() const { return page_; }
+    const char* pages() const { return pages_; }   // "1g", "2m", "thp" or "4k"
+
+    // Place [off, off+len) on `node` before it is first touched.
+    bool bind(size_t off, size_t len, int node) {
+        const size_t a = off / page_ * page_, b = std::min(len_, (off + len + page_ - 1) / page_ * page_);
+        if (b <= a || node < 0 || node >= 64) return false;
+        const unsigned long mask = 1UL << node;
+        return ::syscall(__NR_mbind, base_ + a, b - a, MPOL_BIND, &mask, 64UL, 0U) == 0;
+    }
+
+private:
+    char* base_ = nullptr;
+    size_t len_ = 0, page_ = 4096;
+    const char* pages_ = "4k";
+};
+
+// Thread and buffer placement for a T-way split. Everything is a no-op
+// until enable() is called, so callers use it unconditionally.
+struct Placement {
+    bool on = false;
+    Topology topo;
+    void enable() { on = true; topo = Topology::detect(); }
+    int nodes() const { return on ? topo.nodes() : 1; }
+    int node_of(int th, int T) const { return T > 0 ? (int)((int64_t)th * nodes() / T) : 0; }
+
+    // Pin the calling thread to a CPU of node_of(th, T), round robin inside the node.
+    void pin(int th, int T) const {
+        if (!on) return;
+        const std::vector<int>& cpus = topo.cpus[node_of(th, T)];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[(size_t)th % cpus.size()], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    // Bind a buffer of `len` bytes at `off` as nodes() equal parts, part i on
+    // node i; inner boundaries are rounded to the arena's page size.
+    void bind(Arena& a, size_t off, size_t len) const {
+        if (!on || topo.nodes() < 2) return;
+        const int N = topo.nodes();
+        auto cut = [&](int i) { return i == N ? off + len : (off + len * i / N) / a.page() * a.page(); };
+        for (int i = 0; i < N; ++i) {
+            const size_t lo = std::max(off, cut(i)), hi = cut(i + 1);
+            if (hi <= lo) continue;
+            if (!a.bind(lo, hi - lo, topo.node[i]) && errno != ENOSYS)
+                std::fprintf(stderr, "mbind to node %d failed: %s\n", topo.node[i], std::strerror(errno));
+        }
+    }
+};
+
+} // namespace vmem
@@ -0,0 +1,696 @@
+// vault_reader.h - the read side of a vault: opening either format, the
+// prefix index and filter sidecars, the resumable bound searches, and
+// VaultReader<H, N>, the lookup API on top of them:
+//
+//   find(hash), prefix(bytes, D), range(low, high)
+//                 a Cursor streaming the matching records as (hash, nonce)
+//   bounds(low, high)
+//                 only the matching record range [lo, hi)
+//   lookup_batch(keys, n, D)
+//                 the ranges of many keys, searched in sorted order
+//
+// searchx is built on it; any other tool that needs the records behind a
+// hash can use it the same way. What depends on the record layout takes it
+// as template arguments <H, N> (hash and nonce bytes); the file, sidecar and
+// cache plumbing underneath does not. open_any() opens a vault in whatever
+// layout its header records and returns an AnyReader, from which the
+// matching <H, N> code takes its VaultReader; searchx opens vaults so.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vault_io.h"
+#include "vault_filter.h"
+#include "vault_format.h"
+#include "vault_layout.h"
+
+namespace vrd {
+
+// First record index for every `bits`-bit prefix of the full hash:
+// bucket p is [first[p], first[p+1]) and first[2^bits] == N.
+struct PrefixIndex {
+    int bits = 0;
+    std::vector<uint64_t> first;
+};
+
+// An open vault. For a compressed vault (c > 0) records hold only hash bytes
+// [c, H) and the directory maps each c-byte prefix to its bucket.
+struct Vault {
+    int fd = -1;
+    uint64_t N = 0;
+    int c = 0;
+    size_t rec_bytes = 0;      // stored bytes per record
+    uint64_t data_off = 0;
+    std::vector<uint64_t> dir;
+    uint64_t file_size = 0;
+    int64_t mtime = 0;
+    PrefixIndex index;
+    vflt::Filter filter;   // <vault>.bloom, if vaultx wrote one (--filter)
+};
+
+template <int H, int N>
+static bool open_vault(const std::string& path, Vault& v){
+    v.fd = ::open(path.c_str(), O_RDONLY);
+    if(v.fd<0){ perror("open"); return false; }
+    struct stat st{}; if(fstat(v.fd,&st)!=0){ perror("fstat"); return false; }
+    v.file_size = (uint64_t)st.st_size;
+    v.mtime = (int64_t)st.st_mtime;
+    vfmt::Header h;
+    int kind = vfmt::read_header<H, N>(v.fd, h, v.dir);
+    if(kind<0){ std::fprintf(stderr,"Unreadable, unsupported or damaged vault header\n"); return false; }
+    if(kind==1){
+        v.c=h.prefix_bytes; v.rec_bytes=h.rec_bytes; v.data_off=h.data_offset; v.N=h.records;
+        if((uint64_t)st.st_size != v.data_off + v.N*v.rec_bytes){ std::fprintf(stderr,"Vault size does not match header\n"); return false; }
+        v.index.bits = 8*v.c;   // the directory is already a prefix index
+        v.index.first = v.dir;
+        return true;
+    }
+    v.rec_bytes = H + N;
+    if(st.st_size % v.rec_bytes != 0){ std::fprintf(stderr,"File size not multiple of %zu\n", v.rec_bytes); return false; }
+    v.N = (uint64_t)st.st_size / v.rec_bytes;
+    return true;
+}
+
+// ---- prefix index sidecar (<vault>.idx) ---------------------------------
+
+static const char IDX_MAGIC[8] = {'V','A','U','L','T','X','I','1'};
+struct IndexHeader {
+    char magic[8];
+    uint32_t bits, rec_bytes;
+    uint64_t records, vault_size;
+    int64_t vault_mtime;
+    uint8_t pad[24];
+};
+static_assert(sizeof(IndexHeader) == 64, "index header is 64 bytes");
+
+// Finest prefix that still averages >= 256 records (one 4 KiB page) per
+// bucket, capped at 2^24 entries (128 MiB).
+static int index_bits_for(uint64_t N){
+    int b=0;
+    while(b<24 && (N >> (b+1)) >= 256) ++b;
+    return b;
+}
+
+template <int H>
+static uint32_t top_bits(const uint8_t* hash, int bits){
+    uint32_t v=0;
+    for(int i=0;i<4;++i) v = (v<<8) | (i<H ? hash[i] : 0);
+    return bits ? v >> (32-bits) : 0;
+}
+
+static bool load_index(const std::string& path, const Vault& v, int bits, PrefixIndex& ix){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd<0) return false;
+    IndexHeader h;
+    bool ok = vfmt::pread_exact(fd, &h, sizeof(h), 0) && std::memcmp(h.magic, IDX_MAGIC, 8)==0 &&
+              (int)h.bits==bits && h.rec_bytes==v.rec_bytes && h.records==v.N &&
+              h.vault_size==v.file_size && h.vault_mtime==v.mtime;
+    if(ok){
+        ix.bits = bits;
+        ix.first.resize(((size_t)1<<bits) + 1);
+        ok = vfmt::pread_exact(fd, ix.first.data(), ix.first.size()*sizeof(uint64_t), sizeof(h)) && ix.first.back()==v.N;
+    }
+    ::close(fd);
+    return ok;
+}
+
+// One sequential pass over the vault.
+template <int H, int N>
+static bool build_index(const Vault& v, int bits, PrefixIndex& ix){
+    ix.bits = bits;
+    ix.first.assign(((size_t)1<<bits) + 1, v.N);
+    const uint64_t CHUNK = (4u<<20) / v.rec_bytes;
+    std::vector<uint8_t> buf(CHUNK * v.rec_bytes);
+    int64_t prev = -1;
+    uint32_t dp = 0;                       // directory bucket of record i
+    for(uint64_t i=0; i<v.N; ){
+        uint64_t n = std::min<uint64_t>(CHUNK, v.N - i);
+        if(!vio::pread_all(v.fd, buf.data(), n*v.rec_bytes, (off_t)(v.data_off + i*v.rec_bytes))) return false;
+        for(uint64_t j=0; j<n; ++j, ++i){
+            uint8_t full[H + N];
+            if(v.c){
+                while(v.dir[dp+1] <= i) ++dp;
+                vfmt::decode<H, N>(&buf[j*v.rec_bytes], dp, v.c, full);
+            } else std::memcpy(full, &buf[j*v.rec_bytes], H + N);
+            int64_t p = top_bits<H>(full, bits);
+            for(int64_t q=prev+1; q<=p; ++q) ix.first[q] = i;
+            prev = p;
+        }
+    }
+    return true;
+}
+
+static bool save_index(const std::string& path, const Vault& v, const PrefixIndex& ix){
+    IndexHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, IDX_MAGIC, 8);
+    h.bits = ix.bits; h.rec_bytes = (uint32_t)v.rec_bytes; h.records = v.N;
+    h.vault_size = v.file_size; h.vault_mtime = v.mtime;
+    int fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd<0) return false;
+    bool ok = ::write(fd, &h, sizeof(h))==(ssize_t)sizeof(h) &&
+              ::write(fd, ix.first.data(), ix.first.size()*sizeof(uint64_t))==(ssize_t)(ix.first.size()*sizeof(uint64_t));
+    ::close(fd);
+    return ok;
+}
+
+// ---- bound searches ---------------------------------------------------------
+
+// seeks counts device reads (preads); reads_ok the ones that succeeded;
+// filtered is 1 for a lookup the filter sidecar answered.
+struct QueryStats { uint64_t comps=0, seeks=0, reads_ok=0, bytes=0, filtered=0; };
+
+// Reads a range of stored records and keeps the last one, so the
+// upper-bound search of a query usually reuses the lower bound's block.
+struct BlockReader {
+    const Vault& v;
+    uint64_t lo=0, n=0;
+    std::vector<uint8_t> buf;
+    explicit BlockReader(const Vault& v_) : v(v_) {}
+    const uint8_t* get(uint64_t a, uint64_t cnt, QueryStats& st){
+        if(n && a>=lo && a+cnt<=lo+n) return &buf[(a-lo)*v.rec_bytes];
+        buf.resize(cnt*v.rec_bytes);
+        st.seeks++;
+        if(!vio::pread_all(v.fd, buf.data(), buf.size(), (off_t)(v.data_off + a*v.rec_bytes))){ n=0; return nullptr; }
+        st.reads_ok++; st.bytes += buf.size();
+        lo=a; n=cnt;
+        return buf.data();
+    }
+};
+
+// Stored hash tail against key bytes [c, H), as fixed-width word compares
+// for each prefix length a vault can elide.
+template <int H>
+static inline int cmp_tail(int c, const uint8_t* tail, const uint8_t* key){
+    static_assert(vfmt::MAX_PREFIX == 3, "one case per elided prefix length");
+    switch(c){
+    case 0: return vlay::cmp_be<H>(tail, key);
+    case 1: return vlay::cmp_be<H-1>(tail, key+1);
+    case 2: return vlay::cmp_be<H-2>(tail, key+2);
+    default: return vlay::cmp_be<H-3>(tail, key+3);
+    }
+}
+
+// True if the stored record sorts before the bound: tail < key for a lower
+// bound, tail <= key for an upper bound.
+template <int H>
+static bool before(const Vault& v, const uint8_t* tail, const uint8_t key[H], bool upper, QueryStats& st){
+    st.comps++;
+    int c = cmp_tail<H>(v.c, tail, key);
+    return upper ? c<=0 : c<0;
+}
+
+template <int H>
+static uint64_t bound_in_block(const Vault& v, const uint8_t* blk, uint64_t a, uint64_t cnt,
+                               const uint8_t key[H], bool upper, QueryStats& st){
+    uint64_t lo=0, hi=cnt;
+    while(lo < hi){
+        uint64_t mid = lo + ((hi-lo)>>1);
+        if(before<H>(v, blk + mid*v.rec_bytes, key, upper, st)) lo = mid+1; else hi = mid;
+    }
+    return a + lo;
+}
+
+// First 8 stored hash bytes as a number in [0, 2^64).
+static long double tail_value(const uint8_t* tail, int len){
+    uint64_t x=0;
+    for(int i=0;i<8;++i) x = (x<<8) | (i<len ? tail[i] : 0);
+    return (long double)x;
+}
+
+// Hash bits [from, 8*H) all equal to `one`.
+template <int H>
+static bool rest_bits_are(const uint8_t key[H], int from, bool one){
+    for(int b=from; b<8*H; ++b)
+        if(((key[b/8] >> (7 - b%8)) & 1) != (one ? 1 : 0)) return false;
+    return true;
+}
+
+static const size_t BLOCK_BYTES = 4096;
+
+// Lower (upper=false) or upper bound of key. The prefix index narrows the
+// range to one bucket, and a key that sits on a bucket edge needs no read.
+// Interpolation then guesses where the key lies from its value relative to
+// the range's key span. It reads one page around that guess and either
+// finishes there or shrinks the range to one side of the page. Hashes are
+// uniform, so this usually takes one read, and a range of two pages or less
+// is read whole. After a few misses (skewed data) it falls back to binary,
+// one record per probe; --method binary uses that from the start.
+//
+// The search is a resumable state machine so one thread can keep many in
+// flight: while !done it wants stored records [need_a, need_a+need_n) and
+// continues in feed(). A failed read (data == nullptr) ends it at lo.
+template <int H>
+struct BoundSearch {
+    const uint8_t* key = nullptr;
+    bool upper = false, binary = false, done = false;
+    uint64_t lo = 0, hi = 0, result = 0;
+    uint64_t need_a = 0, need_n = 0;
+    int iter = 0, tl = 0;
+    long double lo_v = 0, hi_v = 0, kv = 0;
+
+    void start(const Vault& v, const uint8_t k[H], bool up, bool interp){
+        key = k; upper = up; binary = !interp; done = false; iter = 0;
+        lo = 0; hi = v.N;
+        int rb = 0;                             // index bits that fall in the stored tail
+        uint32_t p = 0;
+        if(v.index.bits){
+            p = top_bits<H>(key, v.index.bits);
+            lo = v.index.first[p]; hi = v.index.first[p+1];
+            if(rest_bits_are<H>(key, v.index.bits, upper)){ finish(upper ? hi : lo); return; }
+            rb = v.index.bits - 8*v.c;
+        }
+        tl = H - v.c;
+        lo_v = rb ? (long double)(p & ((1u<<rb)-1)) * ldexpl(1.0L, 64-rb) : 0.0L;
+        hi_v = lo_v + ldexpl(1.0L, 64-rb);
+        kv = tail_value(key + v.c, tl);
+        plan(v);
+    }
+
+    void feed(const Vault& v, const uint8_t* data, QueryStats& st){
+        if(!data){ finish(lo); return; }
+        if(binary){
+            if(before<H>(v, data, key, upper, st)) lo = need_a+1; else hi = need_a;
+        } else if(need_a == lo && need_n == hi - lo){
+            finish(bound_in_block<H>(v, data, lo, need_n, key, upper, st)); return;
+        } else {
+            ++iter;
+            const uint8_t* last = data + (need_n-1)*v.rec_bytes;
+            if(!before<H>(v, data, key, upper, st)){ hi = need_a; hi_v = tail_value(data, tl); }
+            else if(before<H>(v, last, key, upper, st)){ lo = need_a + need_n; lo_v = tail_value(last, tl); }
+            else { finish(bound_in_block<H>(v, data, need_a, need_n, key, upper, st)); return; }
+        }
+        plan(v);
+    }
+
+private:
+    void finish(uint64_t r){ result = r; done = true; }
+    void plan(const Vault& v){
+        if(lo >= hi){ finish(lo); return; }
+        const uint64_t n = hi - lo;
+        const uint64_t per_block = std::max<uint64_t>(1, BLOCK_BYTES / v.rec_bytes);
+        if(!binary && n <= 2*per_block){ need_a = lo; need_n = n; return; }
+        if(iter >= 4) binary = true;
+        if(binary){ need_a = lo + (n>>1); need_n = 1; return; }
+        long double f = hi_v > lo_v ? (kv - lo_v) / (hi_v - lo_v) : 0.5L;
+        f = std::min(1.0L, std::max(0.0L, f));
+        uint64_t est = lo + (uint64_t)(f * (long double)n);
+        uint64_t bs = est > lo + per_block/2 ? est - per_block/2 : lo;
+        need_a = std::min(bs, hi - per_block);
+        need_n = per_block;
+    }
+};
+
+// Bounded LRU of vault pages shared by the --serve connections. Pages are
+// PAGE_BYTES of the file; a record range is copied out of the pages it
+// spans. The pread on a miss runs without the lock, so two connections can
+// fetch the same page at once; the second insert is dropped.
+class PageCache {
+public:
+    static const size_t PAGE_BYTES = 4096;
+    PageCache(const Vault& v, size_t max_bytes) : v_(v), max_pages_(std::max<size_t>(16, max_bytes / PAGE_BYTES)) {}
+
+    bool read(uint64_t a, uint64_t n, uint8_t* out, QueryStats& st){
+        uint64_t off = v_.data_off + a*v_.rec_bytes, len = n*v_.rec_bytes;
+        while(len){
+            const uint64_t page = off / PAGE_BYTES, in = off % PAGE_BYTES;
+            const uint64_t take = std::min<uint64_t>(len, PAGE_BYTES - in);
+            if(!copy_from(page, in, take, out, st)) return false;
+            out += take; off += take; len -= take;
+        }
+        return true;
+    }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    typedef std::list<std::pair<uint64_t, std::vector<uint8_t>>> List;
+    bool copy_from(uint64_t page, uint64_t in, uint64_t take, uint8_t* out, QueryStats& st){
+        {
+            std::lock_guard<std::mutex> g(mu_);
+            auto it = pos_.find(page);
+            if(it != pos_.end()){
+                lru_.splice(lru_.begin(), lru_, it->second);
+                std::memcpy(out, it->second->second.data() + in, take);
+                ++hits_;
+                return true;
+            }
+        }
+        std::vector<uint8_t> data(PAGE_BYTES);
+        st.seeks++;
+        ssize_t got = vio::pread_upto(v_.fd, data.data(), PAGE_BYTES, (off_t)(page*PAGE_BYTES));
+        if(got < (ssize_t)(in + take)) return false;
+        st.reads_ok++; st.bytes += (uint64_t)got;
+        std::memcpy(out, data.data() + in, take);
+        std::lock_guard<std::mutex> g(mu_);
+        ++misses_;
+        if(pos_.count(page)) return true;
+        lru_.emplace_front(page, std::move(data));
+        pos_[page] = lru_.begin();
+        if(lru_.size() > max_pages_){ pos_.erase(lru_.back().first); lru_.pop_back(); }
+        return true;
+    }
+    const Vault& v_;
+    const size_t max_pages_;
+    std::mutex mu_;
+    List lru_;
+    std::unordered_map<uint64_t, List::iterator> pos_;
+    uint64_t hits_ = 0, misses_ = 0;
+};
+
+// Blocking record access for one thread: pread through a BlockReader or the
+// server's PageCache, or pointers straight into the mapping (--io mmap).
+// Mapped accesses are counted like BlockReader reads so the stats stay
+// comparable.
+struct SyncSource {
+    const Vault& v;
+    const uint8_t* map;
+    PageCache* cache;
+    BlockReader br;
+    uint64_t last_a=0, last_n=0;
+    SyncSource(const Vault& v_, const uint8_t* map_, PageCache* cache_=nullptr) : v(v_), map(map_), cache(cache_), br(v_) {}
+    const uint8_t* get(uint64_t a, uint64_t n, QueryStats& st){
+        if(cache && !map){
+            br.buf.resize(n*v.rec_bytes);
+            return cache->read(a, n, br.buf.data(), st) ? br.buf.data() : nullptr;
+        }
+        if(!map) return br.get(a, n, st);
+        if(!(last_n && a>=last_a && a+n<=last_a+last_n)){
+            st.seeks++; st.reads_ok++; st.bytes += n*v.rec_bytes;
+            last_a=a; last_n=n;
+        }
+        return map + v.data_off + a*v.rec_bytes;
+    }
+};
+
+template <int H>
+static uint64_t run_bound(const Vault& v, SyncSource& src, BoundSearch<H>& b, QueryStats& st){
+    while(!b.done) b.feed(v, src.get(b.need_a, b.need_n, st), st);
+    return b.result;
+}
+
+template <int H>
+static void make_prefix_bounds(const uint8_t prefix[], int D, uint8_t low[H], uint8_t high[H]){
+    std::memset(low, 0x00, H);
+    std::memset(high,0xFF, H);
+    std::memcpy(low,  prefix, D);
+    std::memcpy(high, prefix, D);
+}
+
+// An exact-hash lookup (low == high) the filter rules out: no match, no reads.
+template <int H>
+static bool rejected_by_filter(const Vault& v, const uint8_t low[H], const uint8_t high[H]){
+    return v.filter.on() && std::memcmp(low, high, H)==0 && !v.filter.may_contain<H>(low);
+}
+
+// ---- VaultReader ------------------------------------------------------------
+
+// Records [lo, hi) of the vault match a lookup.
+struct Span {
+    uint64_t lo = 0, hi = 0;
+    uint64_t count() const { return hi>lo ? hi-lo : 0; }
+};
+
+// One record with its elided hash prefix restored.
+template <int H, int N>
+struct Match {
+    uint8_t hash[H];
+    uint8_t nonce[N];
+    uint64_t nonce_value() const {          // stored little-endian
+        uint64_t x=0;
+        for(int b=N-1; b>=0; --b) x = (x<<8) | nonce[b];
+        return x;
+    }
+};
+
+template <int H, int N> class VaultReader;
+
+// Streams the records of one lookup in order. They are read up to
+// CHUNK_BYTES at a time, so a long range costs a few large sequential
+// reads; the first ones usually still sit in the block the bound search
+// read last, and a mapped vault is read in place.
+template <int H, int N>
+class Cursor {
+public:
+    static const size_t CHUNK_BYTES = 1u << 20;
+
+    const Span& span() const { return span_; }
+    uint64_t first() const { return span_.lo; }
+    uint64_t count() const { return span_.count(); }
+    const QueryStats& stats() const { return st_; }   // the search and the reads so far
+    bool failed() const { return failed_; }
+
+    // Stream at most n more records; count() still reports every match.
+    void limit(uint64_t n){ end_ = std::min(end_, pos_ + n); }
+
+    // Next record, or false at the end or after a failed read (failed()).
+    bool next(Match<H, N>& m){
+        if(pos_ >= end_ || failed_) return false;
+        if(pos_ >= chunk_a_ + chunk_n_){
+            uint64_t n = std::min<uint64_t>(end_ - pos_, std::max<size_t>(1, CHUNK_BYTES / v_->rec_bytes));
+            const BlockReader& br = src_.br;
+            if(br.n && pos_ >= br.lo && pos_ < br.lo + br.n) n = std::min(n, br.lo + br.n - pos_);
+            chunk_ = src_.get(pos_, n, st_);
+            chunk_a_ = pos_; chunk_n_ = chunk_ ? n : 0;
+            if(!chunk_){ failed_ = true; return false; }
+        }
+        if(v_->c){ while(v_->dir[prefix_+1] <= pos_) ++prefix_; }
+        vfmt::decode<H, N>(chunk_ + (pos_ - chunk_a_)*v_->rec_bytes, prefix_, v_->c, reinterpret_cast<uint8_t*>(&m));
+        ++pos_;
+        return true;
+    }
+
+private:
+    friend class VaultReader<H, N>;
+    Cursor(const Vault& v, const uint8_t* map, PageCache* cache) : v_(&v), src_(v, map, cache) {}
+    void seek(const Span& s){
+        span_ = s; pos_ = s.lo; end_ = std::max(s.lo, s.hi);
+        chunk_a_ = chunk_n_ = 0;
+        if(v_->c && pos_ < end_) prefix_ = (uint32_t)(std::upper_bound(v_->dir.begin(), v_->dir.end(), pos_) - v_->dir.begin() - 1);
+    }
+    const Vault* v_;
+    SyncSource src_;
+    QueryStats st_;
+    Span span_;
+    uint64_t pos_ = 0, end_ = 0, chunk_a_ = 0, chunk_n_ = 0;
+    const uint8_t* chunk_ = nullptr;
+    uint32_t prefix_ = 0;
+    bool failed_ = false;
+};
+
+struct ReaderOptions {
+    bool index = true;      // load or build <vault>.idx when the vault has no finer directory
+    bool filter = true;     // use <vault>.bloom when it matches the vault
+    bool interp = true;     // interpolation search; false: binary
+    bool mmap = false;      // map the vault and read records in place
+};
+
+// An open vault and its sidecars. Lookups are const and thread-safe: each
+// thread searches through its own SyncSource (source()) or Cursor.
+template <int H, int N>
+class VaultReader {
+public:
+    typedef vrd::Cursor<H, N> Cursor;
+    typedef vrd::Match<H, N> Match;
+
+    VaultReader() = default;
+    VaultReader(const VaultReader&) = delete;
+    VaultReader& operator=(const VaultReader&) = delete;
+    ~VaultReader(){ close(); }
+
+    bool open(const std::string& path, const ReaderOptions& o = ReaderOptions()){
+        close();
+        opt_ = o;
+        if(!open_vault<H, N>(path, v_)){ close(); return false; }
+
+        // Load <path>.idx, or build it with one scan and save it for next time.
+        index_src_ = v_.c ? "directory" : "none";
+        const int want_bits = index_bits_for(v_.N);
+        if(o.index && want_bits > v_.index.bits){
+            PrefixIndex ix;
+            const std::string ipath = path + ".idx";
+            if(load_index(ipath, v_, want_bits, ix)) index_src_ = "sidecar";
+            else if(build_index<H, N>(v_, want_bits, ix)){
+                index_src_ = save_index(ipath, v_, ix) ? "built" : "built (not saved)";
+            } else ix.bits = 0;
+            if(ix.bits) v_.index = std::move(ix);
+        }
+        if(!o.index && !v_.c) v_.index = PrefixIndex();
+        // <path>.bloom answers exact lookups of absent hashes (vaultx --filter).
+        if(o.filter) v_.filter.load(vflt::sidecar(path), H, N, v_.N, v_.file_size, v_.mtime);
+
+        // A mapping serves vaults that fit in RAM.
+        map_len_ = v_.data_off + v_.N*v_.rec_bytes;
+        if(o.mmap && map_len_){
+            void* m = ::mmap(nullptr, map_len_, PROT_READ, MAP_SHARED, v_.fd, 0);
+            if(m==MAP_FAILED) perror("mmap (falling back to posix)");
+            else { ::madvise(m, map_len_, MADV_RANDOM); map_ = (const uint8_t*)m; }
+        }
+        return true;
+    }
+    void close(){
+        if(map_) ::munmap((void*)map_, map_len_);
+        if(v_.fd>=0) ::close(v_.fd);
+        map_ = nullptr; map_len_ = 0;
+        v_ = Vault();
+    }
+
+    const Vault& vault() const { return v_; }
+    const uint8_t* map() const { return map_; }
+    const char* index_source() const { return index_src_; }
+    bool interp() const { return opt_.interp; }
+    SyncSource source(PageCache* cache = nullptr) const { return SyncSource(v_, map_, cache); }
+
+    // Records whose hash lies in [low, high] (full hashes, both inclusive),
+    // searched through src; st.filtered is set if the filter answered.
+    Span bounds(const uint8_t low[H], const uint8_t high[H], SyncSource& src, QueryStats& st) const {
+        Span s;
+        if(rejected_by_filter<H>(v_, low, high)){ st.filtered = 1; return s; }
+        BoundSearch<H> lb, ub;
+        lb.start(v_, low, false, opt_.interp);
+        s.lo = run_bound(v_, src, lb, st);
+        ub.start(v_, high, true, opt_.interp);
+        s.hi = run_bound(v_, src, ub, st);
+        return s;
+    }
+
+    // Cursors over the records of one full hash, of the D (1..H)
+    // leading hash bytes in `bytes`, of [low, high], or of a known span.
+    // A cache, if given, serves their reads (see PageCache).
+    Cursor find(const uint8_t hash[H], PageCache* cache = nullptr) const { return range(hash, hash, cache); }
+    Cursor prefix(const uint8_t* bytes, int D, PageCache* cache = nullptr) const {
+        uint8_t low[H], high[H];
+        make_prefix_bounds<H>(bytes, D, low, high);
+        return range(low, high, cache);
+    }
+    Cursor range(const uint8_t low[H], const uint8_t high[H], PageCache* cache = nullptr) const {
+        Cursor c(v_, map_, cache);
+        c.seek(bounds(low, high, c.src_, c.st_));
+        return c;
+    }
+    Cursor records(const Span& s, PageCache* cache = nullptr) const {
+        Cursor c(v_, map_, cache);
+        c.seek(s);
+        return c;
+    }
+
+    // Ranges of n lookups at once: key i is the D (1..H) bytes at
+    // keys + i*D, and out[i], st[i] get its range and costs. Keys are
+    // searched in sorted order, so the reads sweep the file front to back
+    // and neighbouring keys share blocks; equal keys are searched once.
+    // While one key is searched, the filter block and index entry of the
+    // key PREFETCH_AHEAD places on are prefetched and, for a mapped vault,
+    // so is the record its first probe will hit.
+    static const size_t PREFETCH_AHEAD = 8;
+    void lookup_batch(const uint8_t* keys, size_t n, int D, Span* out, SyncSource& src, QueryStats* st) const {
+        std::vector<size_t> order(n);
+        for(size_t i=0;i<n;++i) order[i] = i;
+        auto key = [&](size_t i){ return keys + i*(size_t)D; };
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b){ return std::memcmp(key(a), key(b), D) < 0; });
+        for(size_t j=0;j<n;++j){
+            if(j + 2*PREFETCH_AHEAD < n) prefetch(key(order[j + 2*PREFETCH_AHEAD]), D, false);
+            if(j + PREFETCH_AHEAD < n) prefetch(key(order[j + PREFETCH_AHEAD]), D, true);
+            const size_t i = order[j];
+            if(j && std::memcmp(key(i), key(order[j-1]), D)==0){ out[i] = out[order[j-1]]; continue; }
+            uint8_t low[H], high[H];
+            make_prefix_bounds<H>(key(i), D, low, high);
+            out[i] = bounds(low, high, src, st[i]);
+        }
+    }
+
+private:
+    // Two stages: first the filter block and index entry, then (by which
+    // time the entry is cached) the record the first probe reads.
+    void prefetch(const uint8_t* k, int D, bool data) const {
+        uint8_t low[H], high[H];
+        make_prefix_bounds<H>(k, D, low, high);
+        if(!data){
+            if(D==H && v_.filter.on()) v_.filter.prefetch<H>(low);
+            if(v_.index.bits) __builtin_prefetch(&v_.index.first[top_bits<H>(low, v_.index.bits)]);
+            return;
+        }
+        if(!map_) return;
+        BoundSearch<H> b;
+        b.start(v_, low, false, opt_.interp);
+        if(!b.done) __builtin_prefetch(map_ + v_.data_off + (b.need_a + b.need_n/2)*v_.rec_bytes);
+    }
+
+    Vault v_;
+    const uint8_t* map_ = nullptr;
+    size_t map_len_ = 0;
+    ReaderOptions opt_;
+    const char* index_src_ = "none";
+};
+
+// ---- any layout -------------------------------------------------------------
+
+// A VaultReader whose layout was chosen at run time (open_any). The
+// layout-dependent code that searches it gets the typed reader back with
+// as<H, N>().
+class AnyReader {
+public:
+    virtual ~AnyReader() = default;
+    virtual vlay::Layout layout() const = 0;
+    virtual const Vault& vault() const = 0;
+    virtual const char* index_source() const = 0;
+    // The reader as layout H:N, or null if the vault is another layout.
+    template <int H, int N> VaultReader<H, N>* as();
+};
+
+template <int H, int N>
+class AnyReaderOf : public AnyReader {
+public:
+    VaultReader<H, N>& reader(){ return r_; }
+    vlay::Layout layout() const override { return {H, N}; }
+    const Vault& vault() const override { return r_.vault(); }
+    const char* index_source() const override { return r_.index_source(); }
+private:
+    VaultReader<H, N> r_;
+};
+
+template <int H, int N>
+VaultReader<H, N>* AnyReader::as(){
+    const vlay::Layout l = layout();
+    return l.hash==H && l.nonce==N ? &static_cast<AnyReaderOf<H, N>*>(this)->reader() : nullptr;
+}
+
+// The vlay::LAYOUTS entry point that opens a vault as layout H:N.
+template <int H, int N>
+struct Opener {
+    static std::unique_ptr<AnyReader> run(const std::string& path, const ReaderOptions& o){
+        std::unique_ptr<AnyReaderOf<H, N>> r(new AnyReaderOf<H, N>);
+        if(!r->reader().open(path, o)) return nullptr;
+        return std::unique_ptr<AnyReader>(std::move(r));
+    }
+};
+
+// Open a vault of any built layout: the one a compressed vault's header
+// records, else `l` (a plain vault does not record its layout). Null, after
+// a message, if the vault cannot be opened or the layout is not built.
+static inline std::unique_ptr<AnyReader> open_any(const std::string& path, const ReaderOptions& o = ReaderOptions(),
+                                                  vlay::Layout l = vlay::DEFAULT_LAYOUT){
+    vlay::from_header(path.c_str(), l);
+    auto* e = vlay::find(vlay::LAYOUTS<Opener>, l);
+    if(!e){
+        std::fprintf(stderr,"No reader built for layout %d:%d; available: %s\n", l.hash, l.nonce, vlay::names(vlay::LAYOUTS<Opener>).c_str());
+        return nullptr;
+    }
+    return e->fn(path, o);
+}
+
+} // namespace vrd
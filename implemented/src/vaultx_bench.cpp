@@ -0,0 +1,381 @@
+// vaultx_bench.cpp - microbenchmarks for the vaultx hot kernels.
+//
+// It includes vaultx_engine.h, the same engine vaultx.cpp dispatches to, so
+// every kernel is timed exactly as vaultx runs it:
+//
+//   hash    gen_range_ref (blake3_hash_trunc, one hasher per record) and each
+//           batched b3l kernel the CPU supports, generate and list paths
+//   sort    std::sort(rec_less), std::stable_sort and the radix sort on 1 and
+//           T threads, on runs of 2^12 .. --records records
+//   merge   merge_group (loser tree, T partitions) at fan-in 2 .. 64 over the
+//           same total records; the runs sit in the page cache
+//   reader  RunReader streaming one run file, 64 KiB .. 4 MiB chunks,
+//           posix and io_uring
+//   probe   the searchx lookup path on a plain vault with its .idx and
+//           .bloom sidecars: VaultReader::bounds per key and lookup_batch
+//           over all keys, each on the cached vault and on one dropped from
+//           the page cache (POSIX_FADV_DONTNEED, a no-op on tmpfs), plus
+//           the Bloom filter probe of absent keys
+//
+// Inputs come from fixed nonces and a fixed seed, each case runs once to warm
+// up and then --reps times, and the median is reported, so rows from two
+// builds on the same machine can be diffed directly. One row per case:
+//
+//   bench,variant,param,items,reps,median_s,min_s,ns_per_item,mb_per_s
+//
+// as CSV (default) or, with --format json, one document that also records
+// the kernel, record layout and thread count. Kernels are timed for the
+// default 10:6 layout.
+#include "vaultx_engine.h"
+#include "vault_reader.h"
+
+#include <array>
+#include <functional>
+#include <random>
+#include <sstream>
+
+typedef vx::Engine<10, 6> E;   // the default layout (vault_layout.h)
+typedef E::Record Record;
+
+namespace {
+
+typedef std::vector<Record, vio::AlignedAllocator<Record>> RecordBuf;   // uninitialised on resize
+
+volatile uint64_t g_sink;   // keeps measured loops from being optimized away
+
+struct BenchOptions {
+    std::string only;             // comma-separated subset of hash,sort,merge,reader,probe
+    int reps = 5;
+    int threads = 0;
+    uint64_t records = 1ULL << 22; // largest sort run; merge/reader/probe file size
+    size_t mem_mb = 256;           // merge buffer budget, as vaultx -m
+    std::string dir = ".";         // where the temporary run files go
+    std::string format = "csv";
+    std::string out;               // default stdout
+};
+
+struct Row {
+    std::string bench, variant;
+    uint64_t param, items;
+    int reps;
+    double median_s, min_s;
+    uint64_t bytes;                // per rep, for mb_per_s; 0 = not a throughput case
+};
+
+static void print_bench_help() {
+    std::printf(
+"Usage: ./vaultx_bench [OPTIONS]\n"
+"      --only LIST     (comma-separated: hash,sort,merge,reader,probe; default all)\n"
+"      --reps NUM      (timed repetitions per case, median reported; default 5)\n"
+"  -t, --threads NUM   (radix sort and merge threads; default all cores)\n"
+"  -n, --records NUM   (largest sort run and merge/reader/probe file; default 4194304)\n"
+"  -m, --memory NUM    (MB of merge buffers, as vaultx -m; default 256)\n"
+"  -d, --dir DIR       (directory for temporary run files; default .)\n"
+"      --format [csv|json]\n"
+"  -o, --out FILE      (default stdout)\n"
+"  -h, --help\n");
+}
+
+static BenchOptions parse_bench_args(int argc, char** argv) {
+    BenchOptions o;
+    const option long_opts[] = {
+        {"only",    required_argument, nullptr, 'O'},
+        {"reps",    required_argument, nullptr, 'R'},
+        {"threads", required_argument, nullptr, 't'},
+        {"records", required_argument, nullptr, 'n'},
+        {"memory",  required_argument, nullptr, 'm'},
+        {"dir",     required_argument, nullptr, 'd'},
+        {"format",  required_argument, nullptr, 'F'},
+        {"out",     required_argument, nullptr, 'o'},
+        {"help",    no_argument,       nullptr, 'h'},
+        {nullptr,0,nullptr,0}
+    };
+    while (true) {
+        int idx=0; int c = getopt_long(argc, argv, "t:n:m:d:o:h", long_opts, &idx);
+        if (c == -1) break;
+        switch (c) {
+            case 'O': o.only    = optarg; break;
+            case 'R': o.reps    = std::max(1, std::atoi(optarg)); break;
+            case 't': o.threads = std::max(0, std::atoi(optarg)); break;
+            case 'n': o.records = std::max<uint64_t>(4096, std::strtoull(optarg,nullptr,10)); break;
+            case 'm': o.mem_mb  = std::max(1, std::atoi(optarg)); break;
+            case 'd': o.dir     = optarg; break;
+            case 'F': o.format  = optarg; break;
+            case 'o': o.out     = optarg; break;
+            case 'h': print_bench_help(); std::exit(0);
+            default:  print_bench_help(); std::exit(1);
+        }
+    }
+    if (o.format != "csv" && o.format != "json") {
+        std::fprintf(stderr, "Invalid --format; must be csv or json\n");
+        std::exit(1);
+    }
+    return o;
+}
+
+static bool selected(const BenchOptions& o, const char* bench) {
+    if (o.only.empty()) return true;
+    std::stringstream ss(o.only);
+    for (std::string item; std::getline(ss, item, ','); ) if (item == bench) return true;
+    return false;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Runs `once` (which does its own untimed setup and returns the seconds it
+// timed) one warm-up time plus `reps` times.
+static Row measure(const std::string& bench, const std::string& variant, uint64_t param, uint64_t items,
+                   uint64_t bytes, int reps, const std::function<double()>& once) {
+    once();
+    std::vector<double> t;
+    for (int r=0; r<reps; ++r) t.push_back(once());
+    std::sort(t.begin(), t.end());
+    Row row{bench, variant, param, items, reps, t[t.size() / 2], t[0], bytes};
+    std::fprintf(stderr, "  %-6s %-14s %10llu  %.6f s\n", bench.c_str(), variant.c_str(),
+                 (unsigned long long)param, row.median_s);
+    return row;
+}
+
+static void generate(RecordBuf& buf, uint64_t n) {
+    buf.resize(n);
+    E::gen_range(0, 0, n, buf.data());
+}
+
+static bool write_run(const std::string& path, const Record* recs, uint64_t n) {
+    vio::OutFile f = vio::open_out(path, true, false);
+    bool ok = f.fd >= 0 && vio::pwrite_all(f.fd, recs, n * sizeof(Record), 0) && ::fsync(f.fd) == 0;
+    f.close();
+    return ok;
+}
+
+static void bench_hash(const BenchOptions& o, std::vector<Row>& rows) {
+    const uint64_t n = std::min<uint64_t>(o.records, 1ULL << 20);
+    RecordBuf out(n);
+    std::vector<uint64_t> nonces(n);
+    std::mt19937_64 rng(1);
+    for (auto& v: nonces) v = rng() & b3l::Lanes<E::HASH_SIZE, E::NONCE_SIZE>::NONCE_MASK;
+    auto timed = [&](const std::function<void()>& fn) {
+        return [fn] { auto t0 = std::chrono::steady_clock::now(); fn(); return seconds_since(t0); };
+    };
+    rows.push_back(measure("hash", "library", 0, n, n * sizeof(Record), o.reps,
+                           timed([&] { E::gen_range_ref(0, n, out.data()); })));
+    for (const char* name: {"scalar", "avx2", "avx512"}) {
+        b3l::Kernel<E::HASH_SIZE, E::NONCE_SIZE> k = b3l::select_kernel<E::HASH_SIZE, E::NONCE_SIZE>(name);
+        if (std::strcmp(k.name, name) != 0) continue;      // CPU lacks it
+        rows.push_back(measure("hash", std::string(name) + "_gen", 0, n, n * sizeof(Record), o.reps,
+                               timed([&] { k.fn(0, n, out.data()); })));
+        rows.push_back(measure("hash", std::string(name) + "_list", 0, n, n * sizeof(Record), o.reps,
+                               timed([&] { k.hash(nonces.data(), n, out.data()); })));
+    }
+}
+
+static void bench_sort(const BenchOptions& o, int T, std::vector<Row>& rows) {
+    RecordBuf src, a, tmp;
+    generate(src, o.records);
+    a.resize(o.records);
+    tmp.resize(o.records);
+    for (uint64_t n = 1ULL << 12; n <= o.records; n <<= 2) {
+        auto case_ = [&](const std::string& variant, const std::function<void()>& sort) {
+            rows.push_back(measure("sort", variant, n, n, n * sizeof(Record), o.reps, [&] {
+                std::memcpy(a.data(), src.data(), n * sizeof(Record));
+                auto t0 = std::chrono::steady_clock::now();
+                sort();
+                return seconds_since(t0);
+            }));
+        };
+        case_("std_sort", [&] { std::sort(a.data(), a.data() + n, E::rec_less); });
+        case_("std_stable_sort", [&] { std::stable_sort(a.data(), a.data() + n, E::rec_less); });
+        case_("radix_t1", [&] { rsort::radix_sort(a.data(), tmp.data(), n, 1); });
+        if (T > 1) case_("radix_t" + std::to_string(T), [&] { rsort::radix_sort(a.data(), tmp.data(), n, T); });
+    }
+}
+
+static void bench_merge(const BenchOptions& o, int T, std::vector<Row>& rows) {
+    RecordBuf recs, tmp;
+    generate(recs, o.records);
+    tmp.resize(o.records);
+    const std::string prefix = o.dir + "/vaultx_bench";
+    const std::string out = prefix + ".merged";
+    vio::Config io;
+    io.depth = 1;
+    for (size_t K: {2, 4, 8, 16, 32, 64}) {
+        std::vector<std::string> runs;
+        bool ok = true;
+        for (size_t r=0; r<K && ok; ++r) {
+            const uint64_t lo = r * o.records / K, hi = (r + 1) * o.records / K;
+            rsort::radix_sort(recs.data() + lo, tmp.data(), hi - lo, T);
+            runs.push_back(run_name(prefix, (int)r));
+            ok = write_run(runs.back(), recs.data() + lo, hi - lo);
+        }
+        const size_t per_part = o.mem_mb * 1024ULL * 1024ULL / std::max(1, T);
+        if (ok) rows.push_back(measure("merge", "loser_tree_p" + std::to_string(T), K, o.records,
+                                       2 * o.records * sizeof(Record), o.reps, [&] {
+            auto t0 = std::chrono::steady_clock::now();
+            if (!E::merge_group(runs, out, T, per_part, io, "bench")) std::fprintf(stderr, "merge failed\n");
+            return seconds_since(t0);
+        }));
+        else std::fprintf(stderr, "cannot write runs under %s\n", o.dir.c_str());
+        for (auto& r: runs) std::remove(r.c_str());
+        generate(recs, o.records);   // the next K re-sorts fresh slices
+    }
+    std::remove(out.c_str());
+}
+
+static void bench_reader(const BenchOptions& o, std::vector<Row>& rows) {
+    RecordBuf recs;
+    generate(recs, o.records);
+    const std::string path = o.dir + "/vaultx_bench.reader";
+    if (!write_run(path, recs.data(), o.records)) { std::fprintf(stderr, "cannot write %s\n", path.c_str()); return; }
+    vio::Ring probe;
+    const bool uring = probe.init(8);
+    const int fd = vio::open_in(path, false);
+    for (bool use_uring: {false, true}) {
+        if (use_uring && !uring) continue;
+        vio::Config io;
+        io.uring = use_uring;
+        io.depth = use_uring ? 4 : 1;
+        for (size_t chunk: {64u << 10, 256u << 10, 1u << 20, 4u << 20}) {
+            rows.push_back(measure("reader", use_uring ? "uring_d4" : "posix", chunk, o.records,
+                                   o.records * sizeof(Record), o.reps, [&] {
+                auto t0 = std::chrono::steady_clock::now();
+                vio::IoQueue q(io, io.depth);
+                E::RunReader rd(q, fd, 0, o.records, chunk, io.depth);
+                uint8_t x = 0;
+                for (const Record* r = rd.peek(); r; r = rd.peek()) { x ^= r->hash[0]; rd.pop(); }
+                const double s = seconds_since(t0);
+                if (rd.failed) std::fprintf(stderr, "reader failed\n");
+                g_sink += x;
+                return s;
+            }));
+        }
+    }
+    ::close(fd);
+    std::remove(path.c_str());
+}
+
+static void bench_probe(const BenchOptions& o, int T, std::vector<Row>& rows) {
+    RecordBuf recs, tmp;
+    generate(recs, o.records);
+    tmp.resize(o.records);
+    rsort::radix_sort(recs.data(), tmp.data(), o.records, T);
+    const std::string path = o.dir + "/vaultx_bench.probe";
+    vflt::Filter filter;
+    filter.init(o.records, 8, 1);
+    for (uint64_t i=0; i<o.records; ++i) filter.add<E::HASH_SIZE>(recs[i].hash);
+    if (!write_run(path, recs.data(), o.records) ||
+        !filter.save(vflt::sidecar(path), path, E::HASH_SIZE, E::NONCE_SIZE, o.records)) {
+        std::fprintf(stderr, "cannot write %s\n", path.c_str());
+        std::remove(path.c_str());
+        return;
+    }
+    vrd::VaultReader<E::HASH_SIZE, E::NONCE_SIZE> rd;
+    if (!rd.open(path)) { std::remove(path.c_str()); return; }
+    const int fd = rd.vault().fd;
+
+    // Present keys, so every lookup searches the file, and absent ones for the filter.
+    typedef std::array<uint8_t, E::HASH_SIZE> Key;
+    std::vector<Key> keys(1000), absent(1 << 16);
+    std::mt19937_64 rng(2);
+    for (auto& k: keys) std::memcpy(k.data(), recs[rng() % o.records].hash, E::HASH_SIZE);
+    for (auto& k: absent) for (auto& b: k) b = (uint8_t)rng();
+    std::vector<vrd::Span> spans(keys.size());
+    std::vector<vrd::QueryStats> st(keys.size());
+    auto bounds = [&](const Key& k) {
+        vrd::SyncSource src = rd.source();
+        vrd::QueryStats q;
+        return rd.bounds(k.data(), k.data(), src, q).count();
+    };
+    auto batch = [&] {
+        vrd::SyncSource src = rd.source();
+        rd.lookup_batch(keys[0].data(), keys.size(), E::HASH_SIZE, spans.data(), src, st.data());
+        for (auto& sp: spans) g_sink += sp.count();
+    };
+
+    rows.push_back(measure("probe", "bounds_cached", o.records, keys.size(), 0, o.reps, [&] {
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto& k: keys) g_sink += bounds(k);
+        return seconds_since(t0);
+    }));
+    const size_t cold = 100;
+    rows.push_back(measure("probe", "bounds_uncached", o.records, cold, 0, o.reps, [&] {
+        double s = 0;
+        for (size_t i=0; i<cold; ++i) {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            auto t0 = std::chrono::steady_clock::now();
+            g_sink += bounds(keys[i]);
+            s += seconds_since(t0);
+        }
+        return s;
+    }));
+    rows.push_back(measure("probe", "batch_cached", o.records, keys.size(), 0, o.reps, [&] {
+        auto t0 = std::chrono::steady_clock::now();
+        batch();
+        return seconds_since(t0);
+    }));
+    rows.push_back(measure("probe", "batch_uncached", o.records, keys.size(), 0, o.reps, [&] {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        auto t0 = std::chrono::steady_clock::now();
+        batch();
+        return seconds_since(t0);
+    }));
+    const vflt::Filter& f = rd.vault().filter;
+    if (f.on()) rows.push_back(measure("probe", "filter", o.records, absent.size(), 0, o.reps, [&] {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t pass = 0;
+        for (auto& k: absent) pass += f.may_contain<E::HASH_SIZE>(k.data());
+        g_sink += pass;
+        return seconds_since(t0);
+    }));
+    else std::fprintf(stderr, "filter sidecar not loaded\n");
+    rd.close();
+    for (const std::string& p: {path, path + ".idx", vflt::sidecar(path)}) std::remove(p.c_str());
+}
+
+static void write_rows(const BenchOptions& o, int T, const std::vector<Row>& rows, FILE* f) {
+    auto ns = [](const Row& r) { return r.items ? r.median_s * 1e9 / r.items : 0.0; };
+    auto mbps = [](const Row& r) { return r.bytes && r.median_s > 0 ? r.bytes / r.median_s / (1024.0 * 1024.0) : 0.0; };
+    if (o.format == "csv") {
+        std::fprintf(f, "bench,variant,param,items,reps,median_s,min_s,ns_per_item,mb_per_s\n");
+        for (auto& r: rows)
+            std::fprintf(f, "%s,%s,%llu,%llu,%d,%.9f,%.9f,%.3f,%.2f\n", r.bench.c_str(), r.variant.c_str(),
+                         (unsigned long long)r.param, (unsigned long long)r.items, r.reps, r.median_s, r.min_s,
+                         ns(r), mbps(r));
+        return;
+    }
+    std::fprintf(f, "{\n  \"tool\": \"vaultx_bench\",\n  \"kernel\": \"%s\",\n  \"hash_size\": %d,\n  \"nonce_size\": %d,\n"
+                    "  \"threads\": %d,\n  \"records\": %llu,\n  \"rows\": [", E::g_kernel.name, E::HASH_SIZE, E::NONCE_SIZE, T,
+                 (unsigned long long)o.records);
+    for (size_t i=0; i<rows.size(); ++i) {
+        const Row& r = rows[i];
+        std::fprintf(f, "%s\n    {\"bench\": \"%s\", \"variant\": \"%s\", \"param\": %llu, \"items\": %llu, \"reps\": %d, "
+                        "\"median_s\": %.9f, \"min_s\": %.9f, \"ns_per_item\": %.3f, \"mb_per_s\": %.2f}",
+                     i ? "," : "", r.bench.c_str(), r.variant.c_str(), (unsigned long long)r.param,
+                     (unsigned long long)r.items, r.reps, r.median_s, r.min_s, ns(r), mbps(r));
+    }
+    std::fprintf(f, "\n  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions o = parse_bench_args(argc, argv);
+    E::init_hash_kernel();
+    const int T = o.threads > 0 ? o.threads : logical_cores();
+    std::fprintf(stderr, "vaultx_bench: kernel=%s threads=%d records=%llu reps=%d\n", E::g_kernel.name, T,
+                 (unsigned long long)o.records, o.reps);
+
+    std::vector<Row> rows;
+    if (selected(o, "hash"))   bench_hash(o, rows);
+    if (selected(o, "sort"))   bench_sort(o, T, rows);
+    if (selected(o, "merge"))  bench_merge(o, T, rows);
+    if (selected(o, "reader")) bench_reader(o, rows);
+    if (selected(o, "probe"))  bench_probe(o, T, rows);
+
+    FILE* f = o.out.empty() ? stdout : std::fopen(o.out.c_str(), "w");
+    if (!f) { std::fprintf(stderr, "cannot write %s\n", o.out.c_str()); return 1; }
+    write_rows(o, T, rows, f);
+    if (f != stdout) std::fclose(f);
+    return 0;
+}
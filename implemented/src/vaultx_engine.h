@@ -0,0 +1,1941 @@
+// vaultx_engine.h - vaultx: generation, run building, merge, bucketed and
+// sharded builds, verify, and run(), the vaultx command line.
+//
+// Everything that depends on the record layout is a static member of
+// vx::Engine<H, N>, written as if at namespace scope; vaultx.cpp's main()
+// runs the instantiation vlay::LAYOUTS<vx::Engine> names for --layout. The
+// options, I/O setup, pipeline queues and shard markers come first and are
+// compiled once for all layouts.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "BLAKE3/c/blake3.h"
+#include "vault_io.h"
+#include "vault_mem.h"
+#include "metrics.h"
+#include "vault_filter.h"
+#include "vault_layout.h"
+#include "blake3_lanes.h"
+#include "record_sort.h"
+#include "vault_format.h"
+
+static vmet::Registry g_metrics;
+static vmem::Placement g_place;   // --pin: NUMA-local buffers and pinned workers
+
+static void pin_worker(int th, int T) { g_place.pin(th, T); }
+
+static int logical_cores() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? (int)n : 1;
+}
+
+struct Options {
+    std::string approach = "for";
+    int threads = 0;
+    int io_threads = 1;         // run-file writers in the build pipeline
+    int compression = 0;        // leading hash bytes elided in the final vault
+    int exponent_k = 26;        // total records = 2^k
+    size_t mem_mb = 256;        // memory cap (MB)
+    std::string final_file = "output.bin";
+    std::string temp_file  = "temp"; // prefix for run files
+    bool debug = false;
+    size_t batch_size = 262144; // records per worker chunk (not critical here)
+    size_t print_n = 0;
+    size_t search_n = 0;        // reserved for search
+    int difficulty = 3;         // reserved for search
+    bool verify = false;
+    bool verify_full = false;   // --verify full: also recompute hashes, check nonce coverage
+    std::string sort_algo = "radix"; // radix | std
+    std::string io_engine = "posix"; // posix | uring
+    bool direct = false;        // O_DIRECT for runs, merge and verify
+    int io_depth = 4;           // io_uring transfers in flight per stream
+    std::string metrics_file;   // --metrics: JSON report of phases, threads, counters
+    vmem::HugeMode huge = vmem::HUGE_AUTO; // page size for the record-buffer arena
+    bool pin = false;           // pin generator/sort threads, bind buffers per NUMA node
+    std::string shard_dir;      // --shard-dir: multi-process sharded build coordinated here
+    int workers = 1;            // sharded build: worker processes in the job
+    int worker_id = -1;         // this process's worker; -1 forks all workers locally
+    int shards = 0;             // hash-prefix shards (power of two); 0 = sized from -m
+    int shard_timeout = 3600;   // sharded build: seconds without a new marker before giving up; 0 = never
+    std::string job_id;         // sharded build: token in every marker of one job; generated when forking
+    std::vector<std::string> sort_inputs; // --sort-input: sort these record files instead of generating
+    int filter_bits = 0;        // --filter: Bloom filter sidecar bits per record; 0 = none
+    std::string bucket_mode = "auto"; // --approach bucket: auto | resident | spill
+};
+
+static void print_help(vlay::Layout l);
+
+static Options parse_args(int argc, char** argv, vlay::Layout l) {
+    Options o;
+    const char* short_opts = "a:t:i:c:k:m:f:g:b:p:s:q:v:d:h";
+    const option long_opts[] = {
+        {"approach",   required_argument, nullptr, 'a'},
+        {"threads",    required_argument, nullptr, 't'},
+        {"iothreads",  required_argument, nullptr, 'i'},
+        {"compression",required_argument, nullptr, 'c'},
+        {"exponent",   required_argument, nullptr, 'k'},
+        {"memory",     required_argument, nullptr, 'm'},
+        {"file",       required_argument, nullptr, 'f'},
+        {"file_final", required_argument, nullptr, 'g'},
+        {"batch-size", required_argument, nullptr, 'b'},
+        {"print",      required_argument, nullptr, 'p'},
+        {"search",     required_argument, nullptr, 's'},
+        {"difficulty", required_argument, nullptr, 'q'},
+        {"verify",     required_argument, nullptr, 'v'},
+        {"debug",      required_argument, nullptr, 'd'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {"sort",       required_argument, nullptr, 'S'},
+        {"io",         required_argument, nullptr, 'U'},
+        {"direct",     required_argument, nullptr, 'D'},
+        {"io-depth",   required_argument, nullptr, 'Q'},
+        {"metrics",    required_argument, nullptr, 'M'},
+        {"hugepages",  required_argument, nullptr, 'H'},
+        {"pin",        required_argument, nullptr, 'P'},
+        {"shard-dir",  required_argument, nullptr, 'X'},
+        {"workers",    required_argument, nullptr, 'N'},
+        {"worker-id",  required_argument, nullptr, 'I'},
+        {"shards",     required_argument, nullptr, 'B'},
+        {"shard-timeout", required_argument, nullptr, 'O'},
+        {"job-id",     required_argument, nullptr, 'J'},
+        {"sort-input", required_argument, nullptr, 'L'},
+        {"layout",     required_argument, nullptr, 'Y'},
+        {"filter",     required_argument, nullptr, 'F'},
+        {"bucket-mode",required_argument, nullptr, 'R'},
+        {nullptr,0,nullptr,0}
+    };
+    while (true) {
+        int idx=0; int c = getopt_long(argc, argv, short_opts, long_opts, &idx);
+        if (c == -1) break;
+        switch (c) {
+            case 'a': o.approach    = optarg; break;
+            case 't': o.threads     = std::max(0, std::atoi(optarg)); break;
+            case 'i': o.io_threads  = std::max(1, std::atoi(optarg)); break;
+            case 'c': o.compression = std::max(0, std::atoi(optarg)); break;
+            case 'k': o.exponent_k  = std::max(1, std::atoi(optarg)); break;
+            case 'm': o.mem_mb      = std::max(1, std::atoi(optarg)); break;
+            case 'f': o.final_file  = optarg; break;
+            case 'g': o.temp_file   = optarg; break;
+            case 'b': o.batch_size  = std::max<size_t>(1, std::strtoull(optarg,nullptr,10)); break;
+            case 'p': o.print_n     = std::strtoull(optarg,nullptr,10); break;
+            case 's': o.search_n    = std::strtoull(optarg,nullptr,10); break;
+            case 'q': o.difficulty  = std::max(1, std::atoi(optarg)); break;
+            case 'v': o.verify      = (std::string(optarg)=="true" || std::string(optarg)=="full");
+                      o.verify_full = (std::string(optarg)=="full"); break;
+            case 'd': o.debug       = (std::string(optarg)=="true"); break;
+            case 'S': o.sort_algo   = optarg; break;
+            case 'U': o.io_engine   = optarg; break;
+            case 'D': o.direct      = (std::string(optarg)=="true"); break;
+            case 'Q': o.io_depth    = std::max(1, std::atoi(optarg)); break;
+            case 'M': o.metrics_file = optarg; break;
+            case 'H':
+                if (!vmem::parse_huge(optarg, o.huge)) {
+                    std::fprintf(stderr, "Invalid --hugepages; must be auto, off, 2m or 1g\n");
+                    std::exit(1);
+                }
+                break;
+            case 'P': o.pin         = (std::string(optarg)=="true"); break;
+            case 'X': o.shard_dir   = optarg; break;
+            case 'N': o.workers     = std::max(1, std::atoi(optarg)); break;
+            case 'I': o.worker_id   = std::atoi(optarg); break;
+            case 'B': o.shards      = std::max(0, std::atoi(optarg)); break;
+            case 'O': o.shard_timeout = std::max(0, std::atoi(optarg)); break;
+            case 'J': o.job_id      = optarg; break;
+            case 'Y': break;    // main() already picked this engine by it
+            case 'F': o.filter_bits = std::atoi(optarg); break;
+            case 'R': o.bucket_mode = optarg; break;
+            case 'L': {
+                std::stringstream ss(optarg);
+                for (std::string f; std::getline(ss, f, ','); ) if (!f.empty()) o.sort_inputs.push_back(f);
+                break;
+            }
+            case 'h': print_help(l); std::exit(0);
+            default:  print_help(l); std::exit(1);
+        }
+    }
+    if (o.exponent_k > 8 * l.nonce) {
+        std::fprintf(stderr, "Invalid --exponent; a %d-byte nonce numbers at most 2^%d records\n", l.nonce, 8 * l.nonce);
+        std::exit(1);
+    }
+    if (o.compression < 0 || o.compression > std::min(l.hash, vfmt::MAX_PREFIX)) {
+        std::fprintf(stderr, "Invalid --compression; must be 0..%d\n", std::min(l.hash, vfmt::MAX_PREFIX));
+        std::exit(1);
+    }
+    if (o.worker_id >= o.workers || (o.shards & (o.shards - 1)) || o.shards > 65536) {
+        std::fprintf(stderr, "Invalid sharding; --worker-id must be below --workers, --shards a power of two <= 65536\n");
+        std::exit(1);
+    }
+    if (!o.shard_dir.empty() && o.worker_id >= 0 && (o.job_id.empty() || o.job_id.find_first_of(" \n") != std::string::npos)) {
+        std::fprintf(stderr, "--worker-id needs --job-id: one token without spaces, the same for every worker of the job\n");
+        std::exit(1);
+    }
+    if (!o.sort_inputs.empty() && !o.shard_dir.empty()) {
+        std::fprintf(stderr, "--sort-input and --shard-dir cannot be combined\n");
+        std::exit(1);
+    }
+    if (o.filter_bits < 0 || o.filter_bits > 64) {
+        std::fprintf(stderr, "Invalid --filter; must be 0..64 bits per record\n");
+        std::exit(1);
+    }
+    if (o.bucket_mode != "auto" && o.bucket_mode != "resident" && o.bucket_mode != "spill") {
+        std::fprintf(stderr, "Invalid --bucket-mode; must be auto, resident or spill\n");
+        std::exit(1);
+    }
+    if (o.sort_algo != "radix" && o.sort_algo != "std") {
+        std::fprintf(stderr, "Invalid --sort; must be radix or std\n");
+        std::exit(1);
+    }
+    if (o.io_engine != "posix" && o.io_engine != "uring") {
+        std::fprintf(stderr, "Invalid --io; must be posix or uring\n");
+        std::exit(1);
+    }
+    return o;
+}
+
+// input_records: the --sort-input record count, which replaces 2^k; 0 when
+// generating.
+static void print_config(const Options& o, vlay::Layout l, const char* kernel, uint64_t input_records) {
+    const size_t rec_size   = (size_t)(l.hash + l.nonce);
+    const double file_recs  = input_records ? (double)input_records : std::pow(2.0, o.exponent_k);
+    const double target_b   = file_recs * rec_size;
+    const double target_gb  = target_b / (1024.0*1024.0*1024.0);
+
+    std::printf("Selected Approach : %s\n", o.approach.c_str());
+    std::printf("Number of Threads : %d\n", (o.threads>0? o.threads : logical_cores()));
+    if (input_records) std::printf("Input Records : %llu\n", (unsigned long long)input_records);
+    else std::printf("Exponent K : %d\n", o.exponent_k);
+    std::printf("File Size (GB) : %.2f\n", target_gb);
+    std::printf("File Size (bytes) : %.0f\n", target_b);
+    std::printf("Memory Size (MB) : %zu\n", o.mem_mb);
+    std::printf("Memory Size (bytes) : %llu\n", (unsigned long long)(o.mem_mb * 1024ULL * 1024ULL));
+    std::printf("Size of HASH : %d\n", l.hash);
+    std::printf("Size of NONCE : %d\n", l.nonce);
+    std::printf("Size of MemoRecord : %zu\n", rec_size);
+    std::printf("Stored Record Size : %zu\n", rec_size - (size_t)o.compression);
+    std::printf("BATCH_SIZE : %zu\n", o.batch_size);
+    std::printf("Hash Kernel : %s\n", kernel);
+    std::printf("Sort Engine : %s\n", o.sort_algo.c_str());
+    std::printf("Run Buffers : hugepages %s, pin %s\n", vmem::huge_name(o.huge), o.pin ? "true" : "false");
+    if (o.filter_bits)
+        std::printf("Filter Sidecar : %s, %d bits/record\n", vflt::sidecar(o.final_file).c_str(), o.filter_bits);
+    if (!o.shard_dir.empty())
+        std::printf("Sharding : %d workers (%s) via %s\n", o.workers,
+                    o.worker_id < 0 ? "forked here" : ("this is " + std::to_string(o.worker_id)).c_str(), o.shard_dir.c_str());
+    std::printf("I/O Engine : %s%s depth %d\n", o.io_engine.c_str(), o.direct ? " O_DIRECT" : "", o.io_engine == "uring" ? o.io_depth : 1);
+    std::printf("Temporary File Prefix : %s\n", o.temp_file.c_str());
+    std::printf("Final Output File : %s\n", o.final_file.c_str());
+}
+
+// Start the --metrics report with the run's configuration.
+static void start_metrics(const Options& opt, vlay::Layout l, const char* kernel, uint64_t input_records) {
+    g_metrics.start("vaultx", !opt.metrics_file.empty());
+    const std::pair<const char*, std::string> cfg[] = {
+        {"approach", opt.approach}, {"threads", std::to_string(opt.threads > 0 ? opt.threads : logical_cores())},
+        {"iothreads", std::to_string(opt.io_threads)},
+        input_records ? std::make_pair("input_records", std::to_string(input_records))
+                      : std::make_pair("k", std::to_string(opt.exponent_k)),
+        {"memory_mb", std::to_string(opt.mem_mb)}, {"batch_size", std::to_string(opt.batch_size)},
+        {"compression", std::to_string(opt.compression)}, {"sort", opt.sort_algo}, {"io", opt.io_engine},
+        {"direct", opt.direct ? "true" : "false"}, {"io_depth", std::to_string(opt.io_depth)},
+        {"kernel", kernel}, {"hash_size", std::to_string(l.hash)}, {"nonce_size", std::to_string(l.nonce)},
+        {"hugepages", vmem::huge_name(opt.huge)}, {"pin", opt.pin ? "true" : "false"},
+        {"workers", std::to_string(opt.workers)}, {"worker_id", std::to_string(opt.worker_id)},
+        {"filter_bits", std::to_string(opt.filter_bits)}};
+    for (auto& c: cfg) g_metrics.config(c.first, c.second);
+}
+
+// Records of sort scratch needed per record sorted (radix sorts out of place).
+static size_t sort_mem_factor(const Options& o) { return o.sort_algo == "radix" ? 2 : 1; }
+
+static vio::Config io_config(const Options& o) {
+    vio::Config c;
+    c.uring = o.io_engine == "uring";
+    c.direct = o.direct;
+    c.depth = c.uring ? (unsigned)o.io_depth : 1; // POSIX reads block, extra buffers buy nothing
+    return c;
+}
+
+// Fall back to POSIX when the kernel (or a seccomp filter) refuses io_uring.
+static void init_io(Options& o) {
+    if (o.io_engine != "uring") return;
+    vio::Ring probe;
+    if (!probe.init(8)) {
+        std::fprintf(stderr, "io_uring unavailable, using posix I/O\n");
+        o.io_engine = "posix";
+    }
+}
+
+static std::string run_name(const std::string& prefix, int idx) {
+    return prefix + ".run" + std::to_string(idx);
+}
+
+static std::string bucket_name(const std::string& prefix, int idx) {
+    return prefix + ".bucket" + std::to_string(idx);
+}
+
+// Blocking FIFO between pipeline stages; pop() returns false once closed and drained.
+template <typename T>
+struct WorkQueue {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<T> items;
+    bool closed = false;
+    void push(T v) {
+        { std::lock_guard<std::mutex> lk(mu); items.push_back(std::move(v)); }
+        cv.notify_one();
+    }
+    bool pop(T& v) {
+        std::unique_lock<std::mutex> lk(mu);
+        cv.wait(lk, [&] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        v = std::move(items.front()); items.pop_front();
+        return true;
+    }
+    void close() {
+        { std::lock_guard<std::mutex> lk(mu); closed = true; }
+        cv.notify_all();
+    }
+};
+
+// Time a stage spent working vs. blocked on its input (or on a free buffer).
+struct StageClock {
+    double busy = 0.0, stall = 0.0;
+    std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+    double lap() {
+        auto n = std::chrono::high_resolution_clock::now();
+        double d = std::chrono::duration<double>(n - t).count();
+        t = n;
+        return d;
+    }
+    void stalled() { stall += lap(); }
+    void worked()  { busy  += lap(); }
+};
+
+// Temp files removed when this goes out of scope, so an early error return
+// leaves nothing behind either. Empty names are skipped.
+struct TempFiles {
+    std::vector<std::string> names;
+    TempFiles() = default;
+    TempFiles(const TempFiles&) = delete;
+    TempFiles& operator=(const TempFiles&) = delete;
+    ~TempFiles() { for (const std::string& n: names) if (!n.empty()) std::remove(n.c_str()); }
+};
+
+// Sharded build (--shard-dir DIR): N worker processes, on one box or on
+// several nodes sharing DIR and the -f path over a shared filesystem.
+// Worker w generates nonces [w*2^k/N, (w+1)*2^k/N) and scatters them by
+// their top `bits` hash bits into spill files DIR/shard<s>.w<w>, exactly as
+// the bucketed build scatters into buckets, then publishes its per-shard
+// counts in DIR/map<w>.done. Once all N maps are done each worker knows
+// every shard's place in the vault and reduces shards w, w+N, w+2N, ...:
+// it reads the N spills of a shard, sorts them in memory and pwrite()s them
+// into their slice of the final file. Worker 0 then waits for every
+// DIR/reduce<w>.done, writes the header and directory of a compressed vault
+// from the prefixes the reducers published, and removes the markers.
+// Markers are written under a temporary name and rename()d into place; a
+// worker that fails leaves DIR/failed<w> so the others stop waiting, and a
+// worker that sees no new marker for --shard-timeout seconds fails itself.
+// Every marker starts with shard_header(), which carries the --job-id token,
+// so markers a previous job left in DIR are ignored rather than trusted.
+// -m and -t apply per worker process.
+static std::string shard_header(const Options& opt, int bits) {
+    return "vaultx-shard job=" + opt.job_id + " k=" + std::to_string(opt.exponent_k) +
+           " workers=" + std::to_string(opt.workers) + " shards=" + std::to_string(1 << bits) +
+           " c=" + std::to_string(opt.compression);
+}
+
+static std::string marker(const Options& opt, const char* stage, int w) {
+    return opt.shard_dir + "/" + stage + std::to_string(w) + (std::strcmp(stage, "failed") ? ".done" : "");
+}
+
+static bool publish(const std::string& path, const std::string& body) {
+    const std::string tmp = path + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "w");
+    if (!f) return false;
+    bool ok = std::fwrite(body.data(), 1, body.size(), f) == body.size() && std::fflush(f) == 0 && ::fsync(fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// True if the marker exists and was written by the job whose header is head.
+static bool marker_of(const std::string& path, const std::string& head) {
+    std::ifstream in(path);
+    std::string line;
+    return std::getline(in, line) && line == head;
+}
+
+// Block until all N workers have published `stage` for this job (head).
+// False (with the reason in why) if one failed, or if --shard-timeout
+// seconds pass without another worker's marker appearing: a worker that
+// died without leaving a failed marker (a lost node) must not hang the rest
+// of the job.
+static bool wait_markers(const Options& opt, const char* stage, const std::string& head, std::string& why) {
+    int seen = -1;
+    double since = vmet::now_s();
+    while (true) {
+        int ready = 0;
+        for (int w=0; w<opt.workers; ++w) {
+            if (marker_of(marker(opt, "failed", w), head)) {
+                why = "worker " + std::to_string(w) + " failed";
+                return false;
+            }
+            if (marker_of(marker(opt, stage, w), head)) ++ready;
+        }
+        if (ready == opt.workers) return true;
+        if (ready != seen) { seen = ready; since = vmet::now_s(); }
+        else if (opt.shard_timeout > 0 && vmet::now_s() - since > opt.shard_timeout) {
+            why = std::to_string(opt.workers - ready) + " worker(s) published no " + stage + " marker in " +
+                  std::to_string(opt.shard_timeout) + " s";
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+// Read a marker: its header must match this job; the rest is whitespace-separated numbers.
+static bool read_marker(const Options& opt, const char* stage, int w, int bits, std::vector<uint64_t>& vals) {
+    std::ifstream in(marker(opt, stage, w));
+    std::string head;
+    if (!std::getline(in, head) || head != shard_header(opt, bits)) {
+        std::fprintf(stderr, "%s: not written by this job (%s)\n", marker(opt, stage, w).c_str(), head.c_str());
+        return false;
+    }
+    vals.clear();
+    for (uint64_t v; in >> v; ) vals.push_back(v);
+    return true;
+}
+
+// Outcome of verify_vault; the counters are zero for a good vault.
+struct VerifyReport {
+    uint64_t records = 0;
+    uint64_t disorder = 0;     // adjacent pairs out of hash order
+    uint64_t bad_hash = 0;     // hash != BLAKE3(nonce) (full)
+    uint64_t bad_nonce = 0;    // nonce >= 2^k (full)
+    uint64_t duplicate = 0;    // nonce seen more than once (full)
+    uint64_t missing = 0;      // nonce in [0, 2^k) never seen (full)
+    bool layout_error = false; // header, directory or file size inconsistent
+    bool io_error = false;
+    double mbps = 0;
+    bool ok() const {
+        return !layout_error && !io_error && !disorder && !bad_hash && !bad_nonce && !duplicate && !missing;
+    }
+};
+
+static void print_verify(const Options& opt, int T, const VerifyReport& vr, bool ok) {
+    std::cout << (ok ? "verify: OK " : "verify: FAIL ") << "read_MBps=" << std::fixed << std::setprecision(2) << vr.mbps << "\n";
+    std::printf("verify: mode=%s threads=%d records=%llu disorder=%llu bad_hash=%llu bad_nonce=%llu duplicate=%llu missing=%llu%s%s\n",
+        opt.verify_full ? "full" : "order", T, (unsigned long long)vr.records, (unsigned long long)vr.disorder,
+        (unsigned long long)vr.bad_hash, (unsigned long long)vr.bad_nonce, (unsigned long long)vr.duplicate,
+        (unsigned long long)vr.missing, vr.layout_error ? " layout_error" : "", vr.io_error ? " io_error" : "");
+}
+
+namespace vx {
+
+template <int H, int N>
+struct Engine {
+
+static constexpr int HASH_SIZE = H, NONCE_SIZE = N;
+using Record = vlay::Record<H, N>;
+static_assert(sizeof(Record) == (NONCE_SIZE + HASH_SIZE), "Record size must be NONCE_SIZE+HASH_SIZE");
+
+static inline int cmp_hash(const uint8_t* a, const uint8_t* b) { return vlay::cmp_be<HASH_SIZE>(a, b); }
+static inline bool rec_less(const Record& A, const Record& B) { return cmp_hash(A.hash, B.hash) < 0; }
+
+static void blake3_hash_trunc(const uint8_t nonce[NONCE_SIZE], uint8_t out[HASH_SIZE]) {
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    blake3_hasher_update(&hasher, nonce, NONCE_SIZE);
+    uint8_t full[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(&hasher, full, BLAKE3_OUT_LEN);
+    std::memcpy(out, full, HASH_SIZE);
+}
+
+// Reference path: one full hasher round trip per nonce.
+static void gen_range_ref(uint64_t base_nonce, size_t n, Record* out) {
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t v = base_nonce + i;
+        Record r{};
+        for (int b=0; b<NONCE_SIZE; ++b) { r.nonce[b] = (uint8_t)(v & 0xFF); v >>= 8; }
+        blake3_hash_trunc(r.nonce, r.hash);
+        out[i] = r;
+    }
+}
+
+static void hash_list_ref(const uint64_t* nonces, size_t n, Record* out) {
+    for (size_t i = 0; i < n; ++i) gen_range_ref(nonces[i], 1, out + i);
+}
+static inline b3l::Kernel<H, N> g_kernel{"blake3", gen_range_ref, hash_list_ref};
+
+// Pick the widest batched kernel and check it against the BLAKE3 library on
+// a few lane-widths of nonces (including a tail) before trusting it.
+static void init_hash_kernel() {
+    b3l::Kernel<H, N> k = b3l::select_kernel<H, N>();
+    const uint64_t base = 0xFFFFFFF0ULL; // crosses the 32-bit word boundary
+    Record want[37], got[37], listed[37];
+    uint64_t nonces[37];
+    for (int i=0; i<37; ++i) nonces[i] = base + (uint64_t)(i * 7919 % 37);
+    gen_range_ref(base, 37, want);
+    k.fn(base, 37, got);
+    bool ok = std::memcmp(want, got, sizeof(want)) == 0;
+    k.hash(nonces, 37, listed);
+    for (int i=0; i<37 && ok; ++i) ok = std::memcmp(&listed[i], &want[nonces[i] - base], sizeof(Record)) == 0;
+    if (ok) g_kernel = k;
+    else std::fprintf(stderr, "hash kernel %s failed self-test, using blake3 library\n", k.name);
+}
+
+static void gen_range(uint64_t base_nonce, size_t start, size_t end, Record* out) {
+    if (end > start) g_kernel.fn(base_nonce + start, end - start, out + start);
+}
+
+// Sort n records in place; tmp must hold n records when --sort radix.
+// shared_bytes: leading hash bytes known to be equal across all n records.
+// on_thread pins the radix workers (pin_worker) when they own a whole buffer.
+static void sort_records(const Options& o, Record* a, Record* tmp, size_t n, int T, int shared_bytes = 0,
+                         void (*on_thread)(int, int) = nullptr) {
+    if (o.sort_algo == "radix") rsort::radix_sort(a, tmp, n, T, shared_bytes, on_thread);
+    else std::sort(a, a + n, rec_less);
+}
+
+// Carve `count` buffers of `recs` records out of one arena mapping. Buffers
+// start on 2 MiB boundaries so no huge page or NUMA part straddles two of
+// them; with --pin each is bound node by node before its first touch.
+// Empty (after a message) if the mapping fails.
+static std::vector<Record*> carve_buffers(vmem::Arena& arena, const Options& o, size_t count, size_t recs) {
+    const size_t MB2 = 2u << 20;
+    const size_t stride = (std::max<size_t>(1, recs) * sizeof(Record) + MB2 - 1) / MB2 * MB2;
+    if (!arena.init(stride * count, o.huge)) {
+        std::fprintf(stderr, "cannot map %zu MiB of record buffers\n", stride * count >> 20);
+        return {};
+    }
+    if ((o.huge == vmem::HUGE_2M || o.huge == vmem::HUGE_1G) && std::strcmp(arena.pages(), vmem::huge_name(o.huge)) != 0)
+        std::fprintf(stderr, "--hugepages %s: hugetlb pool too small, using %s pages\n", vmem::huge_name(o.huge), arena.pages());
+    std::vector<Record*> out;
+    for (size_t i=0; i<count; ++i) {
+        g_place.bind(arena, i * stride, recs * sizeof(Record));
+        out.push_back(reinterpret_cast<Record*>(arena.data() + i * stride));
+    }
+    return out;
+}
+
+// Top `bits` bits of the hash, read big-endian (same order as cmp_hash).
+static inline uint32_t bucket_of(const uint8_t* h, int bits) {
+    if (bits == 0) return 0;
+    uint32_t top = 0;
+    for (int i=0; i<4; ++i) top = (top << 8) | (i < HASH_SIZE ? h[i] : 0);
+    return top >> (32 - bits);
+}
+
+// Layout of the final vault: plain records when c == 0, otherwise the
+// prefix-elided format of vault_format.h. Final-output writers place record
+// idx at offset(idx), store encode()d bytes and call note() with the prefix
+// of the first record they write for each prefix; finish() fills the
+// directory gaps (empty buckets) and writes header + directory. With
+// --filter the build init()s `filter` for its writers' key ranges and they
+// add every record's hash to it as they write the record.
+struct FinalLayout {
+    int c;
+    uint64_t records;
+    size_t rec_bytes;
+    uint64_t data_off;
+    std::vector<uint64_t> dir;
+    vflt::Filter filter;
+    FinalLayout(int c_, uint64_t n)
+        : c(c_), records(n), rec_bytes(c_ ? vfmt::rec_bytes<H, N>(c_) : sizeof(Record)),
+          data_off(c_ ? vfmt::data_offset(c_) : 0) {
+        if (c) dir.assign(vfmt::dir_entries(c), UINT64_MAX);
+    }
+    uint64_t file_size() const { return data_off + records * rec_bytes; }
+    uint64_t offset(uint64_t idx) const { return data_off + idx * rec_bytes; }
+    uint32_t prefix(const Record& r) const { return vfmt::prefix_of(r.hash, c); }
+    void encode(const Record& r, uint8_t* dst) const {
+        vfmt::encode<H, N>(reinterpret_cast<const uint8_t*>(&r), c, dst);
+    }
+    // A prefix can straddle two writers (merge partitions), so keep the minimum.
+    void note(uint32_t p, uint64_t idx) {
+        uint64_t cur = __atomic_load_n(&dir[p], __ATOMIC_RELAXED);
+        while (idx < cur && !__atomic_compare_exchange_n(&dir[p], &cur, idx, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+    bool finish(int fd) {
+        if (!c) return true;
+        dir.back() = records;
+        for (size_t p = dir.size() - 1; p-- > 0; ) dir[p] = std::min(dir[p], dir[p+1]);
+        vfmt::Header h = vfmt::make_header<H, N>(c, records);
+        // Zero the pad too: shard workers reuse an existing -f without truncating it.
+        const uint64_t dir_end = h.dir_offset + dir.size() * sizeof(uint64_t);
+        const std::vector<char> pad(h.data_offset - dir_end, 0);
+        return vio::pwrite_all(fd, &h, sizeof(h), 0) &&
+               vio::pwrite_all(fd, dir.data(), dir.size() * sizeof(uint64_t), (off_t)h.dir_offset) &&
+               vio::pwrite_all(fd, pad.data(), pad.size(), (off_t)dir_end);
+    }
+};
+
+// Streams records [pos, end) of a sorted run through `depth` rotating chunk
+// buffers: while one chunk is consumed the next ones are already queued on
+// the IoQueue (read-ahead with io_uring). Several readers (one per merge
+// partition) can share one fd. On an O_DIRECT fd chunk offsets and lengths
+// are rounded to vio::ALIGN and the extra records are skipped.
+struct RunReader {
+    vio::IoQueue& q;
+    int fd;
+    bool direct;
+    uint64_t pos, end;          // records not yet handed out
+    uint64_t next_off;          // file offset of the next chunk to request
+    size_t chunk;               // bytes per request
+    std::vector<std::vector<char, vio::AlignedAllocator<char>>> slots;
+    std::vector<uint64_t> tickets, slot_off;
+    size_t cur = 0;
+    const Record* recs = nullptr;
+    size_t i = 0, n = 0;
+    bool failed = false;
+    double io_s = 0;            // seconds in submit/wait (--metrics)
+    RunReader(vio::IoQueue& q_, int fd_, uint64_t begin, uint64_t end_, size_t chunk_bytes, unsigned depth)
+        : q(q_), fd(fd_), direct(vio::is_direct(fd_)), pos(begin), end(end_),
+          chunk(direct ? std::max(vio::ALIGN, vio::align_down(chunk_bytes))
+                       : std::max(sizeof(Record), chunk_bytes / sizeof(Record) * sizeof(Record))),
+          slots(std::max(1u, depth)), tickets(slots.size(), 0), slot_off(slots.size(), 0) {
+        next_off = begin * sizeof(Record);
+        if (direct) next_off = vio::align_down(next_off);
+        for (size_t s=0; s<slots.size(); ++s) { slots[s].resize(chunk); issue(s); }
+        load();
+    }
+    void issue(size_t s) {
+        const uint64_t end_b = end * sizeof(Record);
+        if (next_off >= end_b) { tickets[s] = 0; return; }
+        size_t len = (size_t)std::min<uint64_t>(chunk, end_b - next_off);
+        if (direct) len = vio::align_up(len);
+        slot_off[s] = next_off;
+        const auto t0 = std::chrono::steady_clock::now();
+        tickets[s] = q.submit(false, fd, slots[s].data(), len, (off_t)next_off);
+        io_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        next_off += len;
+    }
+    void load() {
+        i = n = 0;
+        if (!tickets[cur]) return;
+        const auto t0 = std::chrono::steady_clock::now();
+        ssize_t got = q.wait(tickets[cur]);
+        io_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        tickets[cur] = 0;
+        const uint64_t lo = std::max<uint64_t>(pos * sizeof(Record), slot_off[cur]);
+        const uint64_t hi = got < 0 ? 0 : std::min<uint64_t>(slot_off[cur] + (uint64_t)got, end * sizeof(Record));
+        if (hi <= lo) { failed = pos < end; return; }
+        recs = reinterpret_cast<const Record*>(slots[cur].data() + (lo - slot_off[cur]));
+        n = (size_t)((hi - lo) / sizeof(Record));
+        pos += n;
+    }
+    const Record* peek() const { return i < n ? &recs[i] : nullptr; }
+    void pop() {
+        if (++i < n) return;
+        issue(cur);
+        cur = (cur + 1) % slots.size();
+        load();
+    }
+    ~RunReader() { for (uint64_t t: tickets) if (t) q.wait(t); }
+};
+
+// Tournament tree of losers over K readers: tree[0] is the current winner and
+// each internal node keeps the loser of its match, so advancing the winner
+// replays one leaf-to-root path (log2 K compares) and never copies records.
+struct LoserTree {
+    std::vector<RunReader*> src;
+    std::vector<int> tree;
+    size_t K2 = 1;
+    explicit LoserTree(std::vector<RunReader*> s) : src(std::move(s)) {
+        while (K2 < src.size()) K2 <<= 1;
+        tree.assign(K2, -1);
+        tree[0] = K2 > 1 ? build(1) : 0;
+    }
+    // Exhausted (and padding) leaves lose to everything; ties go to the lower run.
+    bool beats(int a, int b) const {
+        const Record* ra = a < (int)src.size() ? src[a]->peek() : nullptr;
+        const Record* rb = b < (int)src.size() ? src[b]->peek() : nullptr;
+        if (!ra) return false;
+        if (!rb) return true;
+        int c = cmp_hash(ra->hash, rb->hash);
+        return c < 0 || (c == 0 && a < b);
+    }
+    int build(size_t node) {
+        if (node >= K2) return (int)(node - K2);
+        int l = build(2*node), r = build(2*node + 1);
+        if (beats(r, l)) std::swap(l, r);
+        tree[node] = r;
+        return l;
+    }
+    const Record* top() const { return (size_t)tree[0] < src.size() ? src[tree[0]]->peek() : nullptr; }
+    void pop() {
+        int w = tree[0];
+        src[w]->pop();
+        for (size_t node = (w + K2) / 2; node > 0; node /= 2)
+            if (beats(tree[node], w)) std::swap(tree[node], w);
+        tree[0] = w;
+    }
+};
+
+// First index in run fd[0..n) whose hash is >= key.
+static uint64_t run_lower_bound(int fd, uint64_t n, const uint8_t key[HASH_SIZE]) {
+    uint64_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint64_t mid = lo + ((hi - lo) >> 1);
+        Record r;
+        if (!vio::pread_all(fd, &r, sizeof(r), (off_t)(mid * sizeof(Record)))) break;
+        if (cmp_hash(r.hash, key) < 0) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Merge sorted runs into `out_path` with P threads. Splitter keys are the
+// quantiles of a sample drawn evenly from every run; a binary search places
+// each splitter in each run, so partition p owns the same key range in all
+// runs and its output offset is the sum of its start positions. Each thread
+// drives its own loser tree and pwrite()s into its own region of the output.
+// With a layout this is the final pass and records are written in its format,
+// and added to its filter; partitions share only the filter blocks of their
+// splitters.
+static bool merge_group(const std::vector<std::string>& runs, const std::string& out_path,
+                        int P, size_t buf_bytes_per_part, const vio::Config& io, const std::string& phase,
+                        FinalLayout* layout = nullptr) {
+    const size_t K = runs.size();
+    // fds stream the runs (O_DIRECT if asked); pfds serve the 16-byte probes.
+    std::vector<int> fds(K, -1), pfds(K, -1);
+    std::vector<uint64_t> len(K, 0);
+    uint64_t total = 0;
+    bool ok = true;
+    for (size_t r=0; r<K; ++r) {
+        fds[r] = vio::open_in(runs[r], io.direct);
+        pfds[r] = ::open(runs[r].c_str(), O_RDONLY);
+        off_t sz = fds[r] >= 0 && pfds[r] >= 0 ? ::lseek(pfds[r], 0, SEEK_END) : -1;
+        if (sz < 0) { ok = false; break; }
+        len[r] = (uint64_t)sz / sizeof(Record);
+        total += len[r];
+    }
+
+    vio::OutFile out;
+    if (ok) out = vio::open_out(out_path, true, io.direct);
+    if (layout && layout->records != total) ok = false;
+    const uint64_t out_size = layout ? layout->file_size() : total * sizeof(Record);
+    if (out.fd < 0 || ::ftruncate(out.fd, (off_t)out_size) != 0) ok = false;
+
+    // bounds[p*K + r]: first record of run r that belongs to partition p.
+    P = (int)std::max<uint64_t>(1, std::min<uint64_t>((uint64_t)P, total / 4096 + 1));
+    std::vector<uint64_t> bounds((size_t)(P + 1) * K, 0);
+    vflt::Filter* filter = layout && layout->filter.on() ? &layout->filter : nullptr;
+    std::vector<uint64_t> edge(P + 1, 0);   // filter block of each splitter
+    if (filter) edge[P] = filter->blocks() - 1;
+    if (ok) {
+        std::vector<Record> sample;
+        const size_t per_run = std::max<size_t>(1, (size_t)64 * P / K);
+        for (size_t r=0; r<K; ++r)
+            for (size_t j=0; j<per_run && len[r]; ++j) {
+                Record rec;
+                if (vio::pread_all(pfds[r], &rec, sizeof(rec), (off_t)((j * len[r] / per_run) * sizeof(Record)))) sample.push_back(rec);
+            }
+        std::sort(sample.begin(), sample.end(), rec_less);
+        for (size_t r=0; r<K; ++r) bounds[(size_t)P * K + r] = len[r];
+        for (int p=1; p<P && !sample.empty(); ++p) {
+            const Record& split = sample[(size_t)p * sample.size() / P];
+            for (size_t r=0; r<K; ++r) bounds[(size_t)p * K + r] = run_lower_bound(pfds[r], len[r], split.hash);
+            if (filter) edge[p] = filter->block_of<HASH_SIZE>(split.hash);
+        }
+    }
+
+    // K readers and one writer per partition, each with io.depth chunks.
+    const size_t chunk = std::max<size_t>(sizeof(Record), buf_bytes_per_part / ((K + 1) * io.depth));
+    std::atomic<bool> good{ok};
+    std::vector<std::thread> pool;
+    for (int p=0; p<P && ok; ++p) {
+        pool.emplace_back([&, p] {
+            const double t0 = vmet::now_s();
+            uint64_t out_pos = 0;
+            for (size_t r=0; r<K; ++r) out_pos += bounds[(size_t)p * K + r];
+            vio::IoQueue q(io, (unsigned)((K + 1) * io.depth));
+            std::vector<std::unique_ptr<RunReader>> readers;
+            std::vector<RunReader*> srcs;
+            for (size_t r=0; r<K; ++r) {
+                readers.emplace_back(new RunReader(q, fds[r], bounds[(size_t)p * K + r], bounds[(size_t)(p + 1) * K + r],
+                                                   chunk, io.depth));
+                srcs.push_back(readers.back().get());
+            }
+            LoserTree lt(srcs);
+            const bool enc = layout && layout->c;
+            vio::SeqWriter w(q, out, (off_t)(layout ? layout->offset(out_pos) : out_pos * sizeof(Record)), chunk, io.depth);
+            uint64_t last = UINT64_MAX;
+            uint8_t stored[sizeof(Record)];
+            for (const Record* r = lt.top(); r; r = lt.top(), ++out_pos) {
+                if (filter) {
+                    const uint64_t fb = filter->block_of<HASH_SIZE>(r->hash);
+                    filter->add<HASH_SIZE>(r->hash, fb == edge[p] || fb == edge[p + 1]);
+                }
+                if (enc) {
+                    uint32_t pf = layout->prefix(*r);
+                    if (pf != last) { layout->note(pf, out_pos); last = pf; }
+                    layout->encode(*r, stored);
+                    w.append(stored, layout->rec_bytes);
+                } else {
+                    w.append(r, sizeof(Record));
+                }
+                lt.pop();
+            }
+            if (!w.finish()) good = false;
+            double read_s = 0;
+            for (auto& rd: readers) { if (rd->failed) good = false; read_s += rd->io_s; }
+            uint64_t recs = 0;
+            for (size_t r=0; r<K; ++r) recs += bounds[(size_t)(p + 1) * K + r] - bounds[(size_t)p * K + r];
+            const double wall = vmet::now_s() - t0;
+            g_metrics.thread(phase, "merge", p, {{"wall_s", wall}, {"read_s", read_s}, {"write_s", w.io_seconds()},
+                                                 {"merge_s", wall - read_s - w.io_seconds()}, {"records", (double)recs}});
+        });
+    }
+    for (auto& th: pool) th.join();
+    for (size_t r=0; r<K; ++r) {
+        if (fds[r] >= 0) ::close(fds[r]);
+        if (pfds[r] >= 0) ::close(pfds[r]);
+    }
+    if (good && layout && !layout->finish(out.fd)) good = false;
+    out.close();
+    return good;
+}
+
+// Plan and run the merge inside the -m budget: P partitions each get an equal
+// share of the buffer memory, and every reader needs at least MIN_READ bytes
+// per in-flight chunk to keep reads sequential, which caps the fan-in F. If there are more runs
+// than F, intermediate passes merge groups of at most F runs into longer runs
+// until one final pass fits. The planner takes the fewest passes first (each
+// is a full read+write of the data) and then the most partitions.
+// Input runs are deleted as they are consumed; on failure every run and
+// pass file still in `runs` or half-written is removed too.
+static bool merge_runs(TempFiles& runs_tf, const Options& opt, int T, FinalLayout& layout) {
+    std::vector<std::string>& runs = runs_tf.names;
+    const size_t MIN_READ = 128 * 1024;
+    const size_t budget = opt.mem_mb * 1024ULL * 1024ULL;
+    const vio::Config io = io_config(opt);
+    auto fan_in = [&](int p) { return std::max<size_t>(2, budget / p / (MIN_READ * io.depth) - 1); };
+    auto count_passes = [&](size_t F) {
+        int n = 1;
+        for (size_t k = runs.size(); k > F; k = (k + F - 1) / F) ++n;
+        return n;
+    };
+    const int fewest = count_passes(fan_in(1));
+    int P = std::max(1, T);
+    while (P > 1 && count_passes(fan_in(P)) > fewest) --P;
+    const size_t per_part = budget / P;
+    const size_t F = fan_in(P);
+    const int passes = count_passes(F);
+    if (opt.debug)
+        std::cerr << "[merge] runs=" << runs.size() << " partitions=" << P << " fan_in=" << F
+                  << " passes=" << passes << "\n";
+    g_metrics.count("merge_passes", passes);
+    g_metrics.count("merge_partitions", P);
+    g_metrics.count("merge_fan_in", F);
+
+    for (int pass = 0; runs.size() > F; ++pass) {
+        const std::string phase = "merge_pass" + std::to_string(pass);
+        vmet::PhaseScope ps(g_metrics, phase);
+        const size_t groups = (runs.size() + F - 1) / F;
+        TempFiles next;
+        for (size_t g=0; g<groups; ++g) {
+            const size_t lo = g * runs.size() / groups, hi = (g + 1) * runs.size() / groups;
+            std::vector<std::string> in(runs.begin() + lo, runs.begin() + hi);
+            next.names.push_back(opt.temp_file + ".pass" + std::to_string(pass) + "." + std::to_string(g));
+            if (!merge_group(in, next.names.back(), P, per_part, io, phase)) return false;
+            for (size_t r=lo; r<hi; ++r) { std::remove(runs[r].c_str()); runs[r].clear(); }
+        }
+        runs.swap(next.names);
+    }
+    vmet::PhaseScope ps(g_metrics, "merge_final");
+    ps.extra = {{"runs", (double)runs.size()}};
+    if (opt.filter_bits) layout.filter.init(layout.records, opt.filter_bits, 1);
+    return merge_group(runs, opt.final_file, P, per_part, io, "merge_final", &layout);
+}
+
+// Scatter records [first, first+total) of the nonce space into the bucket
+// files `names` by their top `bits` hash bits, appending bucket b at record
+// counts[b] (advanced as it goes). Each generation round hashes into one
+// arena buffer and scatters into the other. False (after a message) if a
+// bucket file cannot be written.
+struct ScatterTimes { double gen_s = 0, scatter_s = 0, append_s = 0; };
+static bool scatter_range(const Options& opt, int T, uint64_t first, uint64_t total, int bits,
+                          const std::vector<std::string>& names, std::vector<uint64_t>& counts, ScatterTimes& st) {
+    const size_t rec_size  = sizeof(Record);
+    const uint32_t B = 1u << bits;
+    const size_t round_recs = std::max<size_t>(B, opt.mem_mb * 1024ULL * 1024ULL / (2 * rec_size));
+    const size_t gen_n = (size_t)std::min<uint64_t>(round_recs, total);
+    vmem::Arena arena;
+    std::vector<Record*> ab = carve_buffers(arena, opt, 2, gen_n);
+    if (ab.empty()) return false;
+    Record* gen = ab[0];
+    Record* scat = ab[1];
+    // hist[th*B + b]: records of bucket b in thread th's slice; becomes the
+    // scatter offset after the prefix sum.
+    std::vector<size_t> hist((size_t)T * B);
+    std::vector<size_t> bstart(B + 1);
+
+    uint64_t produced = 0;
+    while (produced < total) {
+        const size_t todo = (size_t)std::min<uint64_t>(gen_n, total - produced);
+        const size_t chunk = (todo + T - 1) / T;
+        std::fill(hist.begin(), hist.end(), 0);
+        double t = vmet::now_s();
+
+        std::vector<std::thread> pool; pool.reserve(T);
+        for (int th=0; th<T; ++th) {
+            pool.emplace_back([&, th] {
+                pin_worker(th, T);
+                size_t start = std::min(todo, th * chunk), end = std::min(todo, start + chunk);
+                gen_range(first + produced, start, end, gen);
+                size_t* h = &hist[(size_t)th * B];
+                for (size_t i=start; i<end; ++i) ++h[bucket_of(gen[i].hash, bits)];
+            });
+        }
+        for (auto& th: pool) th.join();
+        st.gen_s += vmet::now_s() - t; t = vmet::now_s();
+
+        size_t off = 0;
+        for (uint32_t b=0; b<B; ++b) {
+            bstart[b] = off;
+            for (int th=0; th<T; ++th) {
+                size_t c = hist[(size_t)th * B + b];
+                hist[(size_t)th * B + b] = off;
+                off += c;
+            }
+        }
+        bstart[B] = off;
+
+        pool.clear();
+        for (int th=0; th<T; ++th) {
+            pool.emplace_back([&, th] {
+                size_t start = std::min(todo, th * chunk), end = std::min(todo, start + chunk);
+                size_t* h = &hist[(size_t)th * B];
+                for (size_t i=start; i<end; ++i) scat[h[bucket_of(gen[i].hash, bits)]++] = gen[i];
+            });
+        }
+        for (auto& th: pool) th.join();
+        st.scatter_s += vmet::now_s() - t; t = vmet::now_s();
+
+        // Append each bucket's slice of this round; threads own disjoint buckets.
+        std::atomic<bool> ok{true};
+        pool.clear();
+        for (int th=0; th<T; ++th) {
+            pool.emplace_back([&, th] {
+                for (uint32_t b=(uint32_t)th; b<B; b+=(uint32_t)T) {
+                    size_t n = bstart[b+1] - bstart[b];
+                    if (n == 0) continue;
+                    int fd = ::open(names[b].c_str(), O_WRONLY);
+                    if (fd < 0 || !vio::pwrite_all(fd, &scat[bstart[b]], n * rec_size, (off_t)(counts[b] * rec_size))) {
+                        std::fprintf(stderr, "cannot write %s: %s\n", names[b].c_str(), std::strerror(errno));
+                        ok = false;
+                    }
+                    if (fd >= 0) ::close(fd);
+                    counts[b] += n;
+                }
+            });
+        }
+        for (auto& th: pool) th.join();
+        if (!ok) return false;
+        st.append_s += vmet::now_s() - t;
+
+        produced += todo;
+        if (opt.debug) {
+            double pct = (100.0 * produced) / (double)total;
+            std::cerr << "[bucket] scattered " << todo << " recs into " << B << " buckets (" << pct << "%)\n";
+        }
+    }
+    g_metrics.config("buffer_pages", arena.pages());
+    return true;
+}
+
+// Sort the n records of one bucket in buf (tmp: radix scratch) and pwrite
+// them as records [first_idx, first_idx+n) of the final file, compacting in
+// place and noting directory entries for a compressed layout. Buckets own
+// their filter blocks, so the filter is filled without atomics.
+static bool write_sorted_bucket(const Options& opt, Record* buf, Record* tmp, size_t n, int sort_threads,
+                                int shared_bytes, FinalLayout& layout, int out, uint64_t first_idx,
+                                double& sort_s, double& write_s) {
+    double t = vmet::now_s();
+    sort_records(opt, buf, tmp, n, sort_threads, shared_bytes);
+    sort_s += vmet::now_s() - t; t = vmet::now_s();
+    if (layout.filter.on())
+        for (size_t i=0; i<n; ++i) layout.filter.template add<HASH_SIZE>(buf[i].hash);
+    size_t bytes = n * sizeof(Record);
+    if (layout.c) { // compact in place: stored records are shorter
+        uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+        uint64_t last = UINT64_MAX;
+        for (size_t i=0; i<n; ++i) {
+            uint32_t pf = layout.prefix(buf[i]);
+            if (pf != last) { layout.note(pf, first_idx + i); last = pf; }
+            Record r = buf[i];
+            layout.encode(r, dst + i * layout.rec_bytes);
+        }
+        bytes = n * layout.rec_bytes;
+    }
+    const bool ok = vio::pwrite_all(out, buf, bytes, (off_t)layout.offset(first_idx));
+    write_s += vmet::now_s() - t;
+    return ok;
+}
+
+// Bucketed build (--approach bucket): BLAKE3 output is uniform, so the top
+// `bits` hash bits split the key space into B near-equal buckets. Once the
+// bucket sizes are known every bucket owns a precomputed region of the final
+// file, so buckets are sorted independently (in parallel) and pwrite()n
+// straight into place, with no k-way merge. Records reach their bucket one
+// of two ways (--bucket-mode):
+//
+//   resident  a counting pass hashes every nonce and keeps only the bucket
+//             sizes. Buckets are then built in groups that fit -m together:
+//             each group pass regenerates the whole nonce space and keeps
+//             the records of its own buckets in memory, so every record is
+//             written to disk exactly once, at the price of 1 + G hashing
+//             passes for G groups.
+//   spill     one generation pass appends every record to its bucket's temp
+//             file; each file is read back, sorted and written. That is 3N
+//             bytes of I/O, the same as a single-pass run/merge: it saves
+//             the merge's CPU and any intermediate passes, not I/O.
+//
+// auto takes resident unless its G extra hashing passes, at the rate the
+// counting pass measured, would outlast writing and reading every record
+// once more at DISK_MBPS.
+
+// Fewest bucket bits that let T buckets be sorted side by side within -m;
+// beyond 2^12 the per-bucket writes get too small to matter. False if -m is
+// too small for even one bucket.
+static bool bucket_bits(const Options& opt, int T, uint64_t total_records, int& bits) {
+    const int MAX_BITS = 12;
+    const double slack = 1.05; // headroom over the expected bucket size
+    const double per_rec = (double)sizeof(Record) * sort_mem_factor(opt) * slack;
+    const double max_bytes = (double)opt.mem_mb * 1024 * 1024;
+    bits = 0;
+    while (bits < MAX_BITS && (double)(total_records >> bits) * per_rec * T > max_bytes) ++bits;
+    return (double)(total_records >> bits) * per_rec <= max_bytes;
+}
+
+static constexpr size_t GATHER_CHUNK = 16384;   // records a resident-mode thread hashes at a time
+static constexpr double DISK_MBPS = 2000;       // sequential rate of one NVMe device, for --bucket-mode auto
+
+// Hash nonces [0, total) on T threads, each over its own slice in
+// GATHER_CHUNK steps into its part of `chunks` (T * GATHER_CHUNK records),
+// and hand every chunk to fn(th, recs, n).
+template <typename Fn>
+static void for_each_chunk(int T, uint64_t total, Record* chunks, Fn fn) {
+    std::vector<std::thread> pool; pool.reserve(T);
+    for (int th=0; th<T; ++th) {
+        pool.emplace_back([&, th] {
+            pin_worker(th, T);
+            Record* loc = chunks + (size_t)th * GATHER_CHUNK;
+            for (uint64_t i = total * th / T, end = total * (th + 1) / T; i < end; ) {
+                const size_t n = (size_t)std::min<uint64_t>(GATHER_CHUNK, end - i);
+                gen_range(i, 0, n, loc);
+                fn(th, loc, n);
+                i += n;
+            }
+        });
+    }
+    for (auto& th: pool) th.join();
+}
+
+// Sort buckets [b0, b1) on W workers of sort_threads threads each and write
+// them at their final offsets. load(w, b) returns bucket b's counts[b]
+// records (read into worker w's buffer, or already in memory), or nullptr on
+// error; scratch[w] is worker w's radix scratch.
+template <typename Load>
+static bool sort_buckets(const Options& opt, uint32_t b0, uint32_t b1, int bits, const std::vector<uint64_t>& counts,
+                         const std::vector<uint64_t>& final_off, const std::vector<Record*>& scratch, int sort_threads,
+                         FinalLayout& layout, int out, const std::string& phase, Load load) {
+    const int W = (int)scratch.size();
+    std::atomic<uint32_t> next{b0};
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> pool; pool.reserve(W);
+    for (int w=0; w<W; ++w) {
+        pool.emplace_back([&, w] {
+            double read_s = 0, sort_s = 0, write_s = 0;
+            uint64_t recs = 0;
+            for (uint32_t b = next++; b < b1 && ok; b = next++) {
+                double t = vmet::now_s();
+                Record* buf = load(w, b);
+                read_s += vmet::now_s() - t;
+                bool good = buf && write_sorted_bucket(opt, buf, scratch[w], (size_t)counts[b], sort_threads, bits / 8,
+                                                       layout, out, final_off[b], sort_s, write_s);
+                if (!good) ok = false;
+                recs += counts[b];
+                if (opt.debug && good) std::cerr << "[bucket " << b << "] sorted " << counts[b] << " recs\n";
+            }
+            g_metrics.thread(phase, "sort", w, {{"read_s", read_s}, {"sort_s", sort_s}, {"write_s", write_s},
+                                                {"records", (double)recs}});
+        });
+    }
+    for (auto& th: pool) th.join();
+    return ok;
+}
+
+// Buckets grouped for the resident build: group g is buckets
+// [first[g], first[g+1]), the largest group holds `recs` records, and W
+// workers of sort_threads threads each sort its buckets.
+struct GroupPlan {
+    std::vector<uint32_t> first;
+    uint64_t recs = 0, scratch = 0;     // per radix scratch buffer
+    int W = 1, sort_threads = 1;
+    size_t groups() const { return first.size() - 1; }
+};
+
+// The group buffer, T hashing chunks and W radix scratch buffers of the
+// largest bucket share -m, the scratch taking at most half; false if not
+// even one bucket fits beside them.
+static bool plan_groups(const Options& opt, int T, const std::vector<uint64_t>& counts, GroupPlan& plan) {
+    const uint64_t budget = opt.mem_mb * 1024ULL * 1024ULL / sizeof(Record);
+    const uint64_t largest = std::max<uint64_t>(1, *std::max_element(counts.begin(), counts.end()));
+    const uint64_t fixed = (uint64_t)T * GATHER_CHUNK;
+    plan.scratch = sort_mem_factor(opt) > 1 ? largest : 0;
+    if (fixed + plan.scratch + largest > budget) return false;
+    plan.W = (int)std::min<uint64_t>(T, counts.size());
+    while (plan.W > 1 && plan.W * plan.scratch > (budget - fixed) / 2) --plan.W;
+    plan.sort_threads = std::max(1, T / plan.W);
+    const uint64_t cap = budget - fixed - plan.W * plan.scratch;
+    plan.first.assign(1, 0);
+    plan.recs = 0;
+    uint64_t in_group = 0;
+    for (uint32_t b=0; b<counts.size(); ++b) {
+        if (in_group + counts[b] > cap) { plan.first.push_back(b); in_group = 0; }
+        in_group += counts[b];
+        plan.recs = std::max(plan.recs, in_group);
+    }
+    plan.first.push_back((uint32_t)counts.size());
+    return true;
+}
+
+// Resident build: one pass per group regenerates every nonce and keeps the
+// group's records, bucket b at grp[final_off[b] - final_off[first]]; threads
+// reserve each chunk's slots per bucket with one atomic add.
+static bool build_resident(const Options& opt, int T, uint64_t total_records, int bits, const std::vector<uint64_t>& counts,
+                           const std::vector<uint64_t>& final_off, const GroupPlan& plan, FinalLayout& layout, int out) {
+    vmem::Arena grp_arena, chunk_arena, scratch_arena;
+    std::vector<Record*> grp = carve_buffers(grp_arena, opt, 1, (size_t)plan.recs);
+    std::vector<Record*> chunks = carve_buffers(chunk_arena, opt, 1, (size_t)T * GATHER_CHUNK);
+    std::vector<Record*> scratch(plan.W, nullptr);
+    if (plan.scratch) scratch = carve_buffers(scratch_arena, opt, plan.W, (size_t)plan.scratch);
+    if (grp.empty() || chunks.empty() || scratch.empty()) return false;
+    g_metrics.config("buffer_pages", grp_arena.pages());
+
+    const uint32_t B = (uint32_t)counts.size();
+    std::vector<uint32_t> hist((size_t)T * B), ids((size_t)T * GATHER_CHUNK);
+    std::vector<uint64_t> fill(B), at((size_t)T * B);
+    for (size_t g=0; g<plan.groups(); ++g) {
+        const uint32_t b0 = plan.first[g], b1 = plan.first[g + 1], nb = b1 - b0;
+        const std::string phase = "bucket_group" + std::to_string(g);
+        vmet::PhaseScope ps(g_metrics, phase);
+        double t = vmet::now_s();
+        for (uint32_t b=0; b<nb; ++b) fill[b] = final_off[b0 + b] - final_off[b0];
+        for_each_chunk(T, total_records, chunks[0], [&](int th, const Record* r, size_t n) {
+            uint32_t* h = &hist[(size_t)th * B];
+            uint64_t* a = &at[(size_t)th * B];
+            uint32_t* id = &ids[(size_t)th * GATHER_CHUNK];
+            std::fill(h, h + nb, 0);
+            for (size_t i=0; i<n; ++i) {
+                id[i] = bucket_of(r[i].hash, bits) - b0;    // wraps past nb below b0
+                if (id[i] < nb) ++h[id[i]];
+            }
+            for (uint32_t b=0; b<nb; ++b) if (h[b]) a[b] = __atomic_fetch_add(&fill[b], h[b], __ATOMIC_RELAXED);
+            for (size_t i=0; i<n; ++i) if (id[i] < nb) grp[0][a[id[i]]++] = r[i];
+        });
+        const double gen_s = vmet::now_s() - t;
+        const bool ok = sort_buckets(opt, b0, b1, bits, counts, final_off, scratch, plan.sort_threads, layout, out, phase,
+                                     [&](int, uint32_t b) { return grp[0] + (final_off[b] - final_off[b0]); });
+        ps.extra = {{"buckets", (double)nb}, {"records", (double)(final_off[b1] - final_off[b0])}, {"gen_s", gen_s}};
+        if (opt.debug) std::cerr << "[bucket] group " << g << ": buckets " << b0 << ".." << b1 << " written\n";
+        if (!ok) return false;
+    }
+    g_metrics.count("records_generated", total_records * plan.groups());
+    return true;
+}
+
+// Spill build: scatter every record into its bucket's temp file, then read
+// each bucket back, sort it and write it; the bucket files are removed.
+static bool build_spilled(const Options& opt, int T, uint64_t total_records, int bits, FinalLayout& layout, int out) {
+    const size_t max_bytes = opt.mem_mb * 1024ULL * 1024ULL;
+    const uint32_t B = 1u << bits;
+    std::vector<uint64_t> counts(B, 0);
+    std::vector<std::string> names(B);
+    for (uint32_t b=0; b<B; ++b) names[b] = bucket_name(opt.temp_file, (int)b);
+    auto cleanup = [&] { for (const std::string& n: names) std::remove(n.c_str()); };
+    for (uint32_t b=0; b<B; ++b) {
+        int fd = ::open(names[b].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::fprintf(stderr, "cannot open %s for write: %s\n", names[b].c_str(), std::strerror(errno));
+            cleanup();
+            return false;
+        }
+        ::close(fd);
+    }
+
+    {
+        vmet::PhaseScope ps(g_metrics, "bucket_scatter");
+        ScatterTimes st;
+        if (!scatter_range(opt, T, 0, total_records, bits, names, counts, st)) { cleanup(); return false; }
+        ps.extra = {{"buckets", (double)B}, {"gen_s", st.gen_s}, {"scatter_s", st.scatter_s}, {"append_s", st.append_s}};
+        g_metrics.count("records_generated", total_records);
+    }
+
+    // Every bucket's final offset is the prefix sum of the counts before it.
+    std::vector<uint64_t> final_off(B + 1, 0);
+    uint64_t max_count = 0;
+    for (uint32_t b=0; b<B; ++b) {
+        final_off[b+1] = final_off[b] + counts[b];
+        max_count = std::max(max_count, counts[b]);
+    }
+
+    const uint64_t per_bucket = std::max<uint64_t>(1, max_count * sizeof(Record) * sort_mem_factor(opt));
+    int workers = (int)std::max<uint64_t>(1, std::min<uint64_t>(T, max_bytes / per_bucket));
+    const int sort_threads = std::max(1, T / workers);
+    // Read and scratch buffers come from arenas (no zero fill, --pin placed).
+    vmem::Arena buf_arena, scratch_arena;
+    std::vector<Record*> buf = carve_buffers(buf_arena, opt, workers, (size_t)max_count);
+    std::vector<Record*> scratch(workers, nullptr);
+    if (sort_mem_factor(opt) > 1) scratch = carve_buffers(scratch_arena, opt, workers, (size_t)max_count);
+    if (buf.empty() || scratch.empty()) { cleanup(); return false; }
+    vmet::PhaseScope ps(g_metrics, "bucket_sort");
+    const bool ok = sort_buckets(opt, 0, B, bits, counts, final_off, scratch, sort_threads, layout, out, "bucket_sort",
+                                 [&](int w, uint32_t b) -> Record* {
+        int fd = ::open(names[b].c_str(), O_RDONLY);
+        bool good = fd >= 0 && vio::pread_all(fd, buf[w], (size_t)counts[b] * sizeof(Record), 0);
+        if (fd >= 0) ::close(fd);
+        std::remove(names[b].c_str());
+        return good ? buf[w] : nullptr;
+    });
+    if (!ok) cleanup();
+    return ok;
+}
+
+// Errors are reported here (and any bucket files removed); false on error.
+static bool build_bucketed(const Options& opt, int T, uint64_t total_records, int bits, FinalLayout& layout) {
+    const uint32_t B = 1u << bits;
+    if (opt.filter_bits) layout.filter.init(total_records, opt.filter_bits, B);
+
+    // Counting pass (resident and auto): bucket sizes, hence final offsets.
+    std::vector<uint64_t> counts(B, 0), final_off(B + 1, 0);
+    GroupPlan plan;
+    bool resident = false;
+    if (opt.bucket_mode != "spill") {
+        vmet::PhaseScope ps(g_metrics, "bucket_count");
+        const double t0 = vmet::now_s();
+        vmem::Arena arena;
+        std::vector<Record*> chunks = carve_buffers(arena, opt, 1, (size_t)T * GATHER_CHUNK);
+        if (chunks.empty()) return false;
+        std::vector<uint64_t> hist((size_t)T * B, 0);
+        for_each_chunk(T, total_records, chunks[0], [&](int th, const Record* r, size_t n) {
+            uint64_t* h = &hist[(size_t)th * B];
+            for (size_t i=0; i<n; ++i) ++h[bucket_of(r[i].hash, bits)];
+        });
+        for (uint32_t b=0; b<B; ++b) {
+            for (int th=0; th<T; ++th) counts[b] += hist[(size_t)th * B + b];
+            final_off[b + 1] = final_off[b] + counts[b];
+        }
+        const double count_s = vmet::now_s() - t0;
+        g_metrics.count("records_generated", total_records);
+        const bool fits = plan_groups(opt, T, counts, plan);
+        const double spill_s = 2.0 * (double)total_records * sizeof(Record) / (DISK_MBPS * 1e6);
+        resident = fits && (opt.bucket_mode == "resident" || plan.groups() * count_s <= spill_s);
+        ps.extra = {{"buckets", (double)B}, {"groups", fits ? (double)plan.groups() : 0.0}};
+        if (opt.bucket_mode == "resident" && !fits)
+            std::cerr << "bucket: -m " << opt.mem_mb << " cannot hold a resident bucket group, spilling\n";
+        if (opt.debug)
+            std::cerr << "[bucket] " << B << " buckets, counted in " << count_s << " s; "
+                      << (fits ? std::to_string(plan.groups()) : std::string("no")) << " resident groups; using "
+                      << (resident ? "resident" : "spill") << "\n";
+    }
+    g_metrics.config("bucket_mode", resident ? "resident" : "spill");
+
+    int out = ::open(opt.final_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || ::ftruncate(out, (off_t)layout.file_size()) != 0) {
+        std::fprintf(stderr, "cannot open %s for write: %s\n", opt.final_file.c_str(), std::strerror(errno));
+        if (out >= 0) ::close(out);
+        return false;
+    }
+    bool ok = resident ? build_resident(opt, T, total_records, bits, counts, final_off, plan, layout, out)
+                       : build_spilled(opt, T, total_records, bits, layout, out);
+    if (ok && !layout.finish(out)) ok = false;
+    ::close(out);
+    if (!ok) std::fprintf(stderr, "bucket: building %s failed\n", opt.final_file.c_str());
+    return ok;
+}
+
+// Existing record files to sort (--sort-input), read as one concatenated
+// stream of records: file i holds stream records [first[i], first[i+1]).
+// read() is called by the T producer threads on disjoint slices.
+struct InputFiles {
+    std::vector<std::string> names;
+    std::vector<int> fds;
+    std::vector<uint64_t> first{0};
+    uint64_t total() const { return first.back(); }
+    bool open(const std::vector<std::string>& files) {
+        for (const std::string& f: files) {
+            int fd = ::open(f.c_str(), O_RDONLY);
+            off_t sz = fd >= 0 ? ::lseek(fd, 0, SEEK_END) : -1;
+            if (sz < 0) { std::fprintf(stderr, "cannot open input %s\n", f.c_str()); if (fd >= 0) ::close(fd); return false; }
+            if (sz % (off_t)sizeof(Record) != 0) {
+                std::fprintf(stderr, "input %s: %lld bytes is not a multiple of the %zu-byte record\n",
+                             f.c_str(), (long long)sz, sizeof(Record));
+                ::close(fd);
+                return false;
+            }
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            names.push_back(f);
+            fds.push_back(fd);
+            first.push_back(first.back() + (uint64_t)sz / sizeof(Record));
+        }
+        return true;
+    }
+    // Stream records [pos, pos+n) into out; a slice may span files.
+    bool read(uint64_t pos, size_t n, Record* out) const {
+        size_t i = (size_t)(std::upper_bound(first.begin(), first.end(), pos) - first.begin()) - 1;
+        while (n > 0 && i < fds.size()) {
+            const size_t take = (size_t)std::min<uint64_t>(n, first[i + 1] - pos);
+            if (!vio::pread_all(fds[i], out, take * sizeof(Record), (off_t)((pos - first[i]) * sizeof(Record)))) return false;
+            out += take; pos += take; n -= take; ++i;
+        }
+        return n == 0;
+    }
+    ~InputFiles() { for (int fd: fds) ::close(fd); }
+};
+
+// Default build: memory-sized runs, each sorted and spilled, then k-way merged.
+// The three run stages overlap: run N+1 is generated while run N is sorted
+// and earlier runs are written by io_threads writers. Run buffers cycle
+// through a free list, so 2 + io_threads buffers (plus radix scratch) share
+// the -m budget and a slow stage back-pressures the ones before it. With
+// `input` the runs are filled from existing record files instead, each of
+// the T producer threads reading its slice with pread.
+static bool build_runs_merged(const Options& opt, int T, uint64_t total_records, FinalLayout& layout,
+                              const InputFiles* input = nullptr) {
+    const size_t rec_size = sizeof(Record);
+    const int W = opt.io_threads;
+    const size_t slots = 2 + (size_t)W;
+    const vio::Config io = io_config(opt);
+    size_t max_bytes = opt.mem_mb * 1024ULL * 1024ULL;
+    size_t max_recs_per_run = std::max<size_t>(1, max_bytes / (rec_size * (slots + sort_mem_factor(opt) - 1)));
+    max_recs_per_run = (size_t)std::min<uint64_t>(max_recs_per_run, total_records);
+
+    const size_t nruns = (size_t)((total_records + max_recs_per_run - 1) / max_recs_per_run);
+    // Named by a writer before it opens the file, so a failed build removes
+    // partial runs as well as finished ones.
+    TempFiles runs_tf;
+    runs_tf.names.resize(nruns);
+    std::vector<std::string>& runs = runs_tf.names;
+    // Run buffers (and the radix scratch, last) live in one arena for the
+    // whole pipeline: mapped once, never zero-filled, huge pages if possible.
+    vmem::Arena arena;
+    std::vector<Record*> bufs = carve_buffers(arena, opt, std::min(slots, nruns) + (sort_mem_factor(opt) > 1),
+                                              max_recs_per_run);
+    if (bufs.empty()) return false;
+    Record* tmp = nullptr;
+    if (sort_mem_factor(opt) > 1) { tmp = bufs.back(); bufs.pop_back(); }
+    g_metrics.config("buffer_pages", arena.pages());
+    if (opt.debug) std::cerr << "[runs] " << bufs.size() << " buffers in " << arena.size() / (1024 * 1024)
+                             << " MiB of " << arena.pages() << " pages, numa nodes " << g_place.nodes() << "\n";
+
+    struct Job { size_t slot; size_t n; int run; };
+    WorkQueue<size_t> free_q;
+    WorkQueue<Job> sort_q, write_q;
+    for (size_t i=0; i<bufs.size(); ++i) free_q.push(i);
+
+    StageClock gen_c, sort_c;
+    std::vector<StageClock> write_c(W);
+    std::atomic<bool> ok{true};
+    const int phase = g_metrics.begin("runs");
+
+    std::thread sorter([&] {
+        sort_c.lap();
+        Job j{};
+        while (true) {
+            bool got = sort_q.pop(j);
+            sort_c.stalled();
+            if (!got) break;
+            sort_records(opt, bufs[j.slot], tmp, j.n, T, 0, pin_worker);
+            sort_c.worked();
+            write_q.push(j);
+        }
+        write_q.close();
+    });
+
+    std::vector<std::thread> writers; writers.reserve(W);
+    for (int w=0; w<W; ++w) {
+        writers.emplace_back([&, w] {
+            vio::IoQueue q(io, io.depth);
+            StageClock& c = write_c[w];
+            c.lap();
+            Job j{};
+            while (true) {
+                bool got = write_q.pop(j);
+                c.stalled();
+                if (!got) break;
+                runs[j.run] = run_name(opt.temp_file, j.run);
+                vio::OutFile out = vio::open_out(runs[j.run], true, io.direct);
+                if (out.fd < 0) { std::cerr << "cannot open " << runs[j.run] << " for write\n"; ok = false; }
+                else if (!vio::write_buffer(q, out, bufs[j.slot], j.n * sizeof(Record), io.depth)) ok = false;
+                out.close();
+                c.worked();
+                if (opt.debug) std::cerr << "[run " << j.run << "] wrote " << j.n << " recs\n";
+                free_q.push(j.slot);
+            }
+        });
+    }
+
+    uint64_t produced = 0;
+    int run_idx = 0;
+    gen_c.lap();
+    while (produced < total_records && ok) {
+        size_t slot = 0;
+        if (!free_q.pop(slot)) break;
+        gen_c.stalled();
+
+        uint64_t todo = std::min<uint64_t>(max_recs_per_run, total_records - produced);
+        Record* buf = bufs[slot];
+
+        size_t chunk = (todo + T - 1) / T;
+        std::vector<std::thread> pool; pool.reserve(T);
+        for (int th=0; th<T; ++th) {
+            size_t start = th * chunk;
+            if (start >= todo) break;
+            size_t end = std::min<uint64_t>(todo, start + chunk);
+            pool.emplace_back([=, &ok] {
+                pin_worker(th, T);
+                if (!input) gen_range(produced, start, end, buf);
+                else if (!input->read(produced + start, end - start, buf + start)) ok = false;
+            });
+        }
+        for (auto& th: pool) th.join();
+        gen_c.worked();
+
+        sort_q.push(Job{slot, (size_t)todo, run_idx++});
+        produced += todo;
+    }
+    sort_q.close();
+    sorter.join();
+    for (auto& th: writers) th.join();
+    if (!ok) { if (input) std::cerr << "reading the sort input failed\n"; return false; }
+
+    StageClock wsum;
+    for (auto& c: write_c) { wsum.busy += c.busy; wsum.stall += c.stall; }
+    std::printf("pipeline runs=%zu buffers=%zu gen_busy=%.3f gen_stall=%.3f sort_busy=%.3f sort_stall=%.3f "
+                "write_busy=%.3f write_stall=%.3f\n",
+        nruns, bufs.size(), gen_c.busy, gen_c.stall, sort_c.busy, sort_c.stall, wsum.busy / W, wsum.stall / W);
+    g_metrics.thread("runs", "gen", 0, {{"busy_s", gen_c.busy}, {"stall_s", gen_c.stall}});
+    g_metrics.thread("runs", "sort", 0, {{"busy_s", sort_c.busy}, {"stall_s", sort_c.stall}});
+    for (int w=0; w<W; ++w)
+        g_metrics.thread("runs", "write", w, {{"busy_s", write_c[w].busy}, {"stall_s", write_c[w].stall}});
+    g_metrics.count(input ? "records_read" : "records_generated", total_records);
+    g_metrics.count("runs", nruns);
+    g_metrics.end(phase, {{"runs", (double)nruns}, {"buffers", (double)bufs.size()}, {"records_per_run", (double)max_recs_per_run}});
+
+    arena.release(); // hand the budget to the merge
+    if (!merge_runs(runs_tf, opt, T, layout)) { std::cerr << "merge failed\n"; return false; }
+    return true;
+}
+
+// Fewest shards (at least one per worker) whose expected size sorts within -m.
+static int shard_bits(const Options& opt, uint64_t total_records) {
+    if (opt.shards > 0) return __builtin_ctz((unsigned)opt.shards);
+    const double slack = 1.05;
+    int bits = 0;
+    while (bits < 16 && ((1 << bits) < opt.workers ||
+           (double)(total_records >> bits) * sizeof(Record) * sort_mem_factor(opt) * slack > (double)opt.mem_mb * 1024 * 1024)) ++bits;
+    return bits;
+}
+
+static bool shard_worker(const Options& opt, int T, uint64_t total_records, int w, FinalLayout& layout) {
+    const int W = opt.workers;
+    const int bits = shard_bits(opt, total_records);
+    const uint32_t S = 1u << bits;
+    const std::string head = shard_header(opt, bits);
+    if (opt.filter_bits) layout.filter.init(total_records, opt.filter_bits, S);
+    auto fail = [&](const std::string& why) {
+        std::fprintf(stderr, "shard worker %d: %s\n", w, why.c_str());
+        publish(marker(opt, "failed", w), head + "\n" + why + "\n");
+        return false;
+    };
+    ::mkdir(opt.shard_dir.c_str(), 0755);
+
+    // Map: scatter this worker's nonce range into its spill files.
+    std::vector<std::string> spills(S);
+    std::vector<uint64_t> counts(S, 0);
+    for (uint32_t s=0; s<S; ++s) {
+        spills[s] = opt.shard_dir + "/shard" + std::to_string(s) + ".w" + std::to_string(w);
+        int fd = ::open(spills[s].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return fail("cannot create " + spills[s]);
+        ::close(fd);
+    }
+    const uint64_t first = total_records * w / W, last = total_records * (w + 1) / W;
+    {
+        vmet::PhaseScope ps(g_metrics, "shard_map");
+        ScatterTimes st;
+        if (!scatter_range(opt, T, first, last - first, bits, spills, counts, st)) return fail("map scatter failed");
+        ps.extra = {{"shards", (double)S}, {"gen_s", st.gen_s}, {"scatter_s", st.scatter_s}, {"append_s", st.append_s}};
+        g_metrics.count("records_generated", last - first);
+    }
+    std::string body = head + "\n";
+    for (uint64_t c: counts) body += std::to_string(c) + "\n";
+    if (!publish(marker(opt, "map", w), body)) return fail("cannot publish " + marker(opt, "map", w));
+    if (opt.debug) std::cerr << "[shard " << w << "] mapped nonces " << first << ".." << last << " into " << S << " shards\n";
+
+    // Shuffle: every map's counts give each shard's size and vault offset.
+    std::string why;
+    if (!wait_markers(opt, "map", head, why)) return fail("map: " + why);
+    std::vector<std::vector<uint64_t>> per(W);
+    for (int v=0; v<W; ++v)
+        if (!read_marker(opt, "map", v, bits, per[v]) || per[v].size() != S) return fail("bad map marker from worker " + std::to_string(v));
+    std::vector<uint64_t> shard_n(S, 0), shard_off(S + 1, 0);
+    uint64_t largest = 0;
+    for (uint32_t s=0; s<S; ++s) {
+        for (int v=0; v<W; ++v) shard_n[s] += per[v][s];
+        shard_off[s + 1] = shard_off[s] + shard_n[s];
+        if ((int)(s % W) == w) largest = std::max(largest, shard_n[s]);
+    }
+    if (shard_off[S] != total_records) return fail("maps cover " + std::to_string(shard_off[S]) + " records, not 2^k");
+    if (largest * sizeof(Record) * sort_mem_factor(opt) > opt.mem_mb * 1024ULL * 1024ULL)
+        return fail("a shard of " + std::to_string(largest) + " records does not fit -m; raise --shards");
+
+    // Reduce: sort shards w, w+W, ... into their slices of the final file.
+    int out = ::open(opt.final_file.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (out < 0 || ::ftruncate(out, (off_t)layout.file_size()) != 0) {
+        if (out >= 0) ::close(out);
+        return fail("cannot open " + opt.final_file);
+    }
+    bool ok = true;
+    {
+        vmet::PhaseScope ps(g_metrics, "shard_reduce");
+        double read_s = 0, sort_s = 0, write_s = 0;
+        uint64_t recs = 0;
+        vmem::Arena arena;
+        std::vector<Record*> ab = carve_buffers(arena, opt, sort_mem_factor(opt), (size_t)largest);
+        ok = !ab.empty();
+        Record* tmp = ab.size() > 1 ? ab[1] : nullptr;
+        for (uint32_t s=(uint32_t)w; s<S && ok; s+=(uint32_t)W) {
+            double t = vmet::now_s();
+            uint64_t at = 0;
+            for (int v=0; v<W && ok; ++v) {
+                const std::string spill = opt.shard_dir + "/shard" + std::to_string(s) + ".w" + std::to_string(v);
+                int fd = ::open(spill.c_str(), O_RDONLY);
+                ok = fd >= 0 && vio::pread_all(fd, ab[0] + at, per[v][s] * sizeof(Record), 0);
+                if (fd >= 0) ::close(fd);
+                std::remove(spill.c_str());
+                at += per[v][s];
+            }
+            read_s += vmet::now_s() - t;
+            ok = ok && write_sorted_bucket(opt, ab[0], tmp, (size_t)shard_n[s], T, bits / 8, layout, out,
+                                           shard_off[s], sort_s, write_s);
+            recs += shard_n[s];
+            if (opt.debug && ok) std::cerr << "[shard " << w << "] reduced shard " << s << ": " << shard_n[s] << " recs\n";
+        }
+        ps.extra = {{"read_s", read_s}, {"sort_s", sort_s}, {"write_s", write_s}, {"records", (double)recs}};
+    }
+    if (!ok) { ::close(out); return fail("reduce failed"); }
+
+    // --filter: each shard owns its filter blocks; write them into place.
+    int fout = -1;
+    if (layout.filter.on()) {
+        const uint64_t per = layout.filter.blocks() / S;
+        fout = ::open(vflt::sidecar(opt.final_file).c_str(), O_WRONLY | O_CREAT, 0644);
+        ok = fout >= 0 && ::ftruncate(fout, (off_t)(sizeof(vflt::Header) + layout.filter.bytes())) == 0;
+        for (uint32_t s=(uint32_t)w; s<S && ok; s+=(uint32_t)W) ok = layout.filter.write_blocks(fout, s * per, per);
+        if (!ok || ::fsync(fout) != 0) {
+            if (fout >= 0) ::close(fout);
+            ::close(out);
+            return fail("cannot write " + vflt::sidecar(opt.final_file));
+        }
+    }
+
+    // Publish the directory entries this worker found (compressed vaults).
+    body = head + "\n";
+    for (size_t p=0; p<layout.dir.size(); ++p)
+        if (layout.dir[p] != UINT64_MAX) body += std::to_string(p) + " " + std::to_string(layout.dir[p]) + "\n";
+    if (::fsync(out) != 0 || !publish(marker(opt, "reduce", w), body)) { ::close(out); return fail("cannot publish reduce marker"); }
+
+    // Worker 0 finishes the vault once every slice is in place.
+    if (w == 0) {
+        if (!wait_markers(opt, "reduce", head, why)) {
+            if (fout >= 0) ::close(fout);
+            ::close(out);
+            return fail("reduce: " + why);
+        }
+        std::vector<uint64_t> notes;
+        for (int v=0; v<W && ok; ++v) {
+            ok = read_marker(opt, "reduce", v, bits, notes);
+            for (size_t i=0; ok && i+1<notes.size(); i+=2) layout.note((uint32_t)notes[i], notes[i+1]);
+        }
+        ok = ok && layout.finish(out);
+        if (ok && fout >= 0) ok = layout.filter.write_header(fout, opt.final_file, HASH_SIZE, NONCE_SIZE, layout.records);
+        for (int v=0; v<W; ++v) { std::remove(marker(opt, "map", v).c_str()); std::remove(marker(opt, "reduce", v).c_str()); }
+    }
+    if (fout >= 0) ::close(fout);
+    ::close(out);
+    return ok;
+}
+
+// Run this process as --worker-id, or fork all --workers locally and wait;
+// forked workers share a job token made here unless --job-id names one.
+static bool build_sharded(const Options& opt_in, int T, uint64_t total_records, FinalLayout& layout) {
+    if (opt_in.worker_id >= 0) return shard_worker(opt_in, T, total_records, opt_in.worker_id, layout);
+    Options opt = opt_in;
+    if (opt.job_id.empty())
+        opt.job_id = std::to_string(::getpid()) + "-" +
+                     std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    ::mkdir(opt.shard_dir.c_str(), 0755);
+    for (int w=0; w<opt.workers; ++w)
+        for (const char* stage: {"map", "reduce", "failed"}) std::remove(marker(opt, stage, w).c_str());
+    const int Tw = std::max(1, T / opt.workers);
+    std::fflush(stdout);
+    std::vector<pid_t> pids(opt.workers, -1);
+    for (int w=0; w<opt.workers; ++w) {
+        pids[w] = ::fork();
+        if (pids[w] == 0) {
+            bool ok = shard_worker(opt, Tw, total_records, w, layout);
+            std::fflush(stdout); std::fflush(stderr);
+            ::_exit(ok ? 0 : 1);
+        }
+        if (pids[w] < 0) { std::perror("fork"); return false; }
+    }
+    bool ok = true;
+    for (int done=0; done<opt.workers; ++done) {
+        int status = 0;
+        pid_t pid = ::wait(&status);
+        const int w = (int)(std::find(pids.begin(), pids.end(), pid) - pids.begin());
+        if (w < opt.workers && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            ok = false;   // unblock the others
+            publish(marker(opt, "failed", w), shard_header(opt, shard_bits(opt, total_records)) + "\nexited abnormally\n");
+        }
+    }
+    for (int w=0; w<opt.workers; ++w) std::remove(marker(opt, "failed", w).c_str());
+    return ok;
+}
+
+// Sequential reader for either vault format: yields full records in order,
+// restoring elided prefixes from the directory.
+struct VaultScan {
+    int fd = -1;
+    int c = 0;
+    size_t rec_bytes = sizeof(Record);
+    uint64_t data_off = 0, records = 0, idx = 0;
+    std::vector<uint64_t> dir;
+    uint32_t prefix = 0;
+    std::vector<uint8_t> buf;
+    size_t bi = 0, bn = 0;
+    bool bad = false;
+    explicit VaultScan(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { bad = true; return; }
+        vfmt::Header h;
+        int kind = vfmt::read_header<H, N>(fd, h, dir);
+        if (kind < 0) { bad = true; return; }
+        if (kind == 1) { c = h.prefix_bytes; rec_bytes = h.rec_bytes; data_off = h.data_offset; records = h.records; }
+        else records = (uint64_t)std::max<off_t>(0, ::lseek(fd, 0, SEEK_END)) / sizeof(Record);
+        buf.resize(rec_bytes * 65536);
+    }
+    ~VaultScan() { if (fd >= 0) ::close(fd); }
+    bool next(Record& r) {
+        if (bad || idx >= records) return false;
+        if (bi == bn) {
+            size_t want = (size_t)std::min<uint64_t>(buf.size() / rec_bytes, records - idx);
+            if (!vio::pread_all(fd, buf.data(), want * rec_bytes, (off_t)(data_off + idx * rec_bytes))) { bad = true; return false; }
+            bi = 0; bn = want;
+        }
+        if (c) {
+            while (dir[prefix + 1] <= idx) ++prefix;
+            vfmt::decode<H, N>(&buf[bi * rec_bytes], prefix, c, reinterpret_cast<uint8_t*>(&r));
+        } else {
+            std::memcpy(&r, &buf[bi * rec_bytes], sizeof(Record));
+        }
+        ++bi; ++idx;
+        return true;
+    }
+};
+
+// Parallel verifier for either vault format. The records are split into
+// fixed chunks handed out to T threads. Each thread checks its chunk's
+// interior order plus the pair that straddles the next chunk, so every
+// adjacent pair is checked exactly once. With `full`, every record's hash
+// is also recomputed from its nonce with the batched kernel (HashFn), and
+// each nonce sets its bit in a shared 2^k-bit bitmap with an atomic OR; a
+// bit already set is a duplicate, and a clear bit left at the end is a
+// missing nonce. The file is mapped read-only, or read with pread when
+// --direct asks for O_DIRECT (through aligned bounce buffers).
+static bool verify_vault(const std::string& final_file, const vio::Config& io, int T, bool full, int k,
+                         VerifyReport& rep) {
+    rep = VerifyReport();
+    int fd = vio::open_in(final_file, io.direct);
+    if (fd < 0) { rep.io_error = true; return false; }
+    const bool direct = vio::is_direct(fd);
+    const uint64_t size_bytes = (uint64_t)std::max<off_t>(0, ::lseek(fd, 0, SEEK_END));
+    // The header and directory are small unaligned reads, which an O_DIRECT
+    // fd refuses: read them through a buffered one.
+    const int hfd = direct ? ::open(final_file.c_str(), O_RDONLY) : fd;
+    if (hfd < 0) { rep.io_error = true; ::close(fd); return false; }
+    vfmt::Header h;
+    std::vector<uint64_t> dir;
+    const int kind = vfmt::read_header<H, N>(hfd, h, dir);
+    if (hfd != fd) ::close(hfd);
+    int c = 0;
+    size_t rec_bytes = sizeof(Record);
+    uint64_t data_off = 0, nrec = size_bytes / sizeof(Record);
+    if (kind < 0) rep.layout_error = true;
+    if (kind == 1) {
+        c = h.prefix_bytes; rec_bytes = h.rec_bytes; data_off = h.data_offset; nrec = h.records;
+        if (size_bytes != data_off + nrec * rec_bytes || dir[0] != 0) rep.layout_error = true;
+        for (size_t p = 1; p < dir.size(); ++p) if (dir[p] < dir[p-1]) rep.layout_error = true;
+    } else if (kind == 0 && size_bytes % sizeof(Record) != 0) rep.layout_error = true;
+    if (full && k > 40) { std::fprintf(stderr, "verify full: nonce bitmap for k=%d is too large\n", k); full = false; }
+    rep.records = nrec;
+    if (rep.layout_error) { ::close(fd); return false; }
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    const uint8_t* map = nullptr;
+    if (!direct && size_bytes) {
+        void* m = ::mmap(nullptr, size_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) { rep.io_error = true; ::close(fd); return false; }
+        ::madvise(m, size_bytes, MADV_SEQUENTIAL);
+        map = static_cast<const uint8_t*>(m);
+    }
+    const uint64_t expected = full ? (1ULL << k) : 0;
+    std::vector<uint64_t> seen(full ? (expected + 63) / 64 : 0, 0);
+
+    const uint64_t CHUNK = std::max<uint64_t>(1, (32u << 20) / rec_bytes);
+    const uint64_t chunks = (nrec + CHUNK - 1) / CHUNK;
+    std::atomic<uint64_t> next{0};
+    std::mutex mu;
+
+    auto worker = [&]() {
+        VerifyReport mine;
+        std::vector<uint8_t, vio::AlignedAllocator<uint8_t>> buf;
+        const size_t BATCH = 4096;
+        std::vector<Record> recs(BATCH), expect(BATCH);
+        std::vector<uint64_t> nonces(BATCH);
+        auto check_batch = [&](size_t n) {
+            g_kernel.hash(nonces.data(), n, expect.data());
+            for (size_t i = 0; i < n; ++i) {
+                if (std::memcmp(recs[i].hash, expect[i].hash, HASH_SIZE) != 0) ++mine.bad_hash;
+                if (nonces[i] >= expected) { ++mine.bad_nonce; continue; }
+                const uint64_t bit = 1ULL << (nonces[i] & 63);
+                if (__atomic_fetch_or(&seen[nonces[i] >> 6], bit, __ATOMIC_RELAXED) & bit) ++mine.duplicate;
+            }
+        };
+        for (uint64_t ci = next++; ci < chunks; ci = next++) {
+            const uint64_t begin = ci * CHUNK, end = std::min(nrec, begin + CHUNK);
+            const uint64_t stop = std::min(nrec, end + 1);          // one past: the boundary pair
+            const uint64_t off = data_off + begin * rec_bytes, len = (stop - begin) * rec_bytes;
+            const uint8_t* p;
+            if (map) p = map + off;
+            else {
+                const uint64_t a = vio::align_down(off);
+                buf.resize(vio::align_up(off + len) - a);
+                if (vio::pread_upto(fd, buf.data(), buf.size(), (off_t)a) < (ssize_t)(off + len - a)) { mine.io_error = true; break; }
+                p = buf.data() + (off - a);
+            }
+            uint32_t prefix = c ? (uint32_t)(std::upper_bound(dir.begin(), dir.end(), begin) - dir.begin() - 1) : 0;
+            Record prev{}, r;
+            size_t nb = 0;
+            for (uint64_t i = begin; i < stop; ++i) {
+                const uint8_t* src = p + (i - begin) * rec_bytes;
+                if (c) {
+                    while (dir[prefix + 1] <= i) ++prefix;
+                    vfmt::decode<H, N>(src, prefix, c, reinterpret_cast<uint8_t*>(&r));
+                } else std::memcpy(&r, src, sizeof(Record));
+                if (i > begin && cmp_hash(prev.hash, r.hash) > 0) ++mine.disorder;
+                prev = r;
+                if (!full || i == end) continue;
+                uint64_t v = 0;
+                for (int b = NONCE_SIZE - 1; b >= 0; --b) v = (v << 8) | r.nonce[b];
+                recs[nb] = r; nonces[nb] = v;
+                if (++nb == BATCH) { check_batch(nb); nb = 0; }
+            }
+            if (nb) check_batch(nb);
+        }
+        std::lock_guard<std::mutex> g(mu);
+        rep.disorder += mine.disorder; rep.bad_hash += mine.bad_hash;
+        rep.bad_nonce += mine.bad_nonce; rep.duplicate += mine.duplicate;
+        rep.io_error = rep.io_error || mine.io_error;
+    };
+    std::vector<std::thread> pool;
+    for (int i = 0; i < std::max(1, T); ++i) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+
+    if (full) {
+        uint64_t have = 0;
+        for (uint64_t w : seen) have += (uint64_t)__builtin_popcountll(w);
+        rep.missing = expected - have;
+    }
+    if (map) ::munmap((void*)map, size_bytes);
+    ::close(fd);
+    double sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    rep.mbps = (size_bytes / (1024.0*1024.0)) / (sec>0?sec:1.0);
+    return rep.ok();
+}
+
+static void print_first(const std::string& final_file, size_t count) {
+    VaultScan in(final_file);
+    if (in.bad) { std::cerr << "cannot open " << final_file << "\n"; return; }
+    Record r;
+    for (size_t i=0; i<count && in.next(r); ++i) {
+        std::cout << "[" << (in.data_off + i*in.rec_bytes) << "] ";
+        for (int j=0;j<HASH_SIZE;j++) std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)r.hash[j];
+        std::cout << std::dec << " nonce=";
+        unsigned long long dec=0;
+        for (int b=NONCE_SIZE-1;b>=0;--b) dec = (dec<<8) | r.nonce[b];
+        std::cout << dec << "\n";
+    }
+}
+
+static int run(int argc, char** argv) {
+    Options opt = parse_args(argc, argv, {HASH_SIZE, NONCE_SIZE});
+    if (opt.pin) g_place.enable();
+    init_hash_kernel();
+    init_io(opt);
+
+    const size_t rec_size = sizeof(Record);
+    InputFiles input;
+    if (!opt.sort_inputs.empty()) {
+        if (!input.open(opt.sort_inputs)) return 1;
+        if (input.total() == 0) { std::fprintf(stderr, "--sort-input: no records to sort\n"); return 1; }
+    }
+    print_config(opt, {HASH_SIZE, NONCE_SIZE}, g_kernel.name, input.total());
+    start_metrics(opt, {HASH_SIZE, NONCE_SIZE}, g_kernel.name, input.total());
+    if (!input.fds.empty()) {
+        std::printf("Sort Input : %zu files, %llu records\n", input.fds.size(), (unsigned long long)input.total());
+        if (opt.approach == "bucket") std::fprintf(stderr, "--sort-input uses the run/merge build\n");
+        if (opt.verify_full) {
+            std::fprintf(stderr, "--verify full checks a generated vault's nonces; checking order only\n");
+            opt.verify_full = false;
+        }
+        g_metrics.config("sort_inputs", std::to_string(input.fds.size()));
+    }
+    const uint64_t total_records = input.fds.empty() ? (uint64_t)1 << opt.exponent_k : input.total();
+
+    int T = (opt.threads>0? opt.threads : logical_cores());
+
+    // A sidecar left by an earlier build could pass for this vault's; the
+    // workers of a sharded job each write part of it, so only its starter
+    // removes it.
+    if (opt.shard_dir.empty() || opt.worker_id < 0) std::remove(vflt::sidecar(opt.final_file).c_str());
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    FinalLayout layout(opt.compression, total_records);
+    if (opt.compression && layout.file_size() >= total_records * rec_size)
+        std::fprintf(stderr, "warning: -c %d directory outweighs the savings at %llu records\n", opt.compression,
+                     (unsigned long long)total_records);
+    bool done = false;
+    if (!opt.shard_dir.empty()) {
+        if (!build_sharded(opt, T, total_records, layout)) return 1;
+        if (opt.worker_id > 0) {    // worker 0 finishes, verifies and reports
+            std::printf("shard worker %d done\n", opt.worker_id);
+            if (!opt.metrics_file.empty() && !g_metrics.write(opt.metrics_file))
+                std::fprintf(stderr, "cannot write metrics to %s\n", opt.metrics_file.c_str());
+            return 0;
+        }
+        done = true;
+    }
+    if (!done && opt.approach == "bucket" && input.fds.empty()) {
+        int bits = 0;
+        if (!bucket_bits(opt, T, total_records, bits))
+            std::cerr << "bucket: -m " << opt.mem_mb << " too small for one bucket, falling back to run/merge\n";
+        else if (!build_bucketed(opt, T, total_records, bits, layout)) return 1;
+        else done = true;
+    }
+    if (!done && !build_runs_merged(opt, T, total_records, layout, input.fds.empty() ? nullptr : &input)) return 1;
+    if (layout.filter.on() && opt.shard_dir.empty()) {   // shard workers wrote theirs in place
+        vmet::PhaseScope ps(g_metrics, "filter_write");
+        ps.extra = {{"bytes", (double)layout.filter.bytes()}};
+        if (!layout.filter.save(vflt::sidecar(opt.final_file), opt.final_file, HASH_SIZE, NONCE_SIZE, total_records)) {
+            std::fprintf(stderr, "cannot write %s\n", vflt::sidecar(opt.final_file).c_str());
+            return 1;
+        }
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    double total_sec = std::chrono::duration<double>(t1 - t0).count();
+    if (total_sec <= 0) total_sec = 1e-9;
+
+    double mh_s = (total_records / 1e6) / total_sec;
+    double mb_s = ((total_records * rec_size) / (1024.0*1024.0)) / total_sec;
+    if (opt.compression)
+        std::printf("compressed vault: %zu-byte records, %.2f%% of plain size\n",
+            layout.rec_bytes, 100.0 * layout.file_size() / (double)(total_records * rec_size));
+
+    int rc = 0;
+    if (opt.verify) {
+        VerifyReport vr;
+        const int phase = g_metrics.begin(opt.verify_full ? "verify_full" : "verify");
+        bool ok = verify_vault(opt.final_file, io_config(opt), T, opt.verify_full, opt.exponent_k, vr);
+        g_metrics.end(phase, {{"records", (double)vr.records}, {"read_MBps", vr.mbps}, {"ok", ok ? 1.0 : 0.0}});
+        print_verify(opt, T, vr, ok);
+        if (!ok) rc = 1;
+    }
+    if (opt.print_n > 0) print_first(opt.final_file, opt.print_n);
+
+    // The size field: k<exponent> for a generated vault, n<records> for a sorted input.
+    const std::string size_field = input.fds.empty() ? "k" + std::to_string(opt.exponent_k)
+                                                     : "n" + std::to_string(total_records);
+    std::printf("vaultx t%d i%d m%zu %s %.2f %.2f %.6f\n",
+        (opt.threads>0? opt.threads : logical_cores()),
+        opt.io_threads, opt.mem_mb, size_field.c_str(), mh_s, mb_s, total_sec);
+    if (!opt.metrics_file.empty() && !g_metrics.write(opt.metrics_file))
+        std::fprintf(stderr, "cannot write metrics to %s\n", opt.metrics_file.c_str());
+    return rc;
+}
+
+}; // struct Engine
+
+} // namespace vx
+
+static void print_help(vlay::Layout l) {
+    std::printf(
+"Usage: ./vaultx [OPTIONS]\n"
+"  -a, --approach [task|for|bucket]\n"
+"      --bucket-mode [auto|resident|spill] (bucket: regenerate per group to write once, or spill to temp files)\n"
+"  -t, --threads NUM\n"
+"  -i, --iothreads NUM\n"
+"  -c, --compression NUM (0..%d leading hash bytes elided; 0 = plain vault)\n"
+"  -k, --exponent NUM\n"
+"  -m, --memory NUM    (MB)\n"
+"  -f, --file NAME     (final output)\n"
+"  -g, --file_final NAME (temp prefix for runs)\n"
+"  -b, --batch-size NUM\n"
+"  -p, --print NUM\n"
+"  -s, --search NUM    (TODO)\n"
+"  -q, --difficulty NUM\n"
+"  -v, --verify [true|false|full] (full: also recompute every hash, check each nonce once)\n"
+"  -d, --debug [true|false]\n"
+"      --sort [radix|std]  (run sort engine, default radix)\n"
+"      --io [posix|uring]  (bulk I/O backend, default posix)\n"
+"      --direct [true|false] (O_DIRECT for runs, merge and verify)\n"
+"      --io-depth NUM      (io_uring requests in flight per stream)\n"
+"      --metrics FILE      (write per-phase/per-thread timers and counters as JSON)\n"
+"      --hugepages [auto|off|2m|1g] (page size for run buffers, default auto)\n"
+"      --pin [true|false]  (pin generator/sort threads, NUMA-local run buffers)\n"
+"      --shard-dir DIR     (sharded build: worker processes coordinate through DIR)\n"
+"      --workers NUM       (sharded build: worker processes, default 1)\n"
+"      --worker-id NUM     (run as this worker only; default forks all workers here)\n"
+"      --shards NUM        (sharded build: hash-prefix shards, power of two; default from -m)\n"
+"      --shard-timeout SEC (sharded build: fail if no worker finishes a stage for SEC; 0 = wait forever, default 3600)\n"
+"      --job-id ID         (sharded build: same token for every worker of one job; required with --worker-id)\n"
+"      --sort-input FILE[,FILE...] (sort existing record files into -f; repeatable)\n"
+"      --filter BITS       (also write FILE.bloom, a Bloom filter of BITS per record, e.g. 8)\n"
+"      --layout HASH:NONCE (record layout in bytes, default 10:6; built: %s)\n"
+"  -h, --help\n", std::min(l.hash, vfmt::MAX_PREFIX), vlay::names(vlay::LAYOUTS<vx::Engine>).c_str());
+}